@@ -0,0 +1,320 @@
+// Recycled memory for pixel buffers. See BufferPool.h
+
+#include "BufferPool.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdlib.h>
+#include <vector>
+#include <string.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+static const size_t Alignment = 64;
+static const size_t HeaderSize = 64;        // Keeps the data behind the header aligned
+static const size_t MinClassSize = 64;
+static const int MaxClasses = 4 * 64;
+
+// Small buffers are cached on the thread that freed them, a few per class
+static const size_t ThreadCacheMaxSize = 256 * 1024;
+static const int ThreadCacheCount = 8;
+
+struct BufferHeader {
+    BufferHeader* next;         // Free list link while cached
+    size_t size;                // Usable bytes behind the header
+    int sizeClass;              // -1 for buffers too large to cache
+};
+static_assert(sizeof(BufferHeader) <= HeaderSize, "header must fit in front of the data");
+
+struct ThreadCache;
+
+struct Pool {
+    size_t classSizes[MaxClasses];
+    int numClasses = 0;
+
+    std::mutex mutex;
+    BufferHeader* freeLists[MaxClasses] = {};
+
+    std::atomic<size_t> bytesInUse{ 0 };
+    std::atomic<size_t> bytesCached{ 0 };
+    std::atomic<size_t> limit{ (size_t)512 * 1024 * 1024 };
+    std::atomic<unsigned long long> allocations{ 0 };
+    std::atomic<unsigned long long> hits{ 0 };
+
+    // Every live thread cache, so a trim can empty them all
+    std::mutex cachesMutex;
+    std::vector<ThreadCache*> caches;
+
+    // 64, 80, 96, 112, 128, 160, ...: four classes per power of two
+    Pool() {
+        for (size_t base = MinClassSize; numClasses + 4 <= MaxClasses; base *= 2) {
+            for (size_t step = 4; step < 8; step++) {
+                classSizes[numClasses++] = base / 4 * step;
+            }
+            if (base > ((size_t)-1 >> 3))
+                break;
+        }
+    }
+
+    int ClassOf(size_t bytes) const {
+        const size_t* end = classSizes + numClasses;
+        const size_t* it = std::lower_bound(classSizes, end, bytes);
+        return it == end ? -1 : (int)(it - classSizes);
+    }
+};
+
+// Never destroyed: buffers may be freed from static destructors and exiting threads
+static Pool& GetPool()
+{
+    static Pool* pool = new Pool();
+    return *pool;
+}
+
+static BufferHeader* AllocateFromOS(size_t size, int sizeClass)
+{
+#ifdef _WIN32
+    void* memory = _aligned_malloc(HeaderSize + size, Alignment);
+#else
+    void* memory = nullptr;
+    if (posix_memalign(&memory, Alignment, HeaderSize + size) != 0)
+        memory = nullptr;
+#endif
+    if (!memory)
+        return nullptr;
+    BufferHeader* header = (BufferHeader*)memory;
+    header->next = nullptr;
+    header->size = size;
+    header->sizeClass = sizeClass;
+    return header;
+}
+
+static void FreeToOS(BufferHeader* header)
+{
+#ifdef _WIN32
+    _aligned_free(header);
+#else
+    free(header);
+#endif
+}
+
+static void* DataOf(BufferHeader* header)
+{
+    return (unsigned char*)header + HeaderSize;
+}
+
+static BufferHeader* HeaderOf(void* p)
+{
+    return (BufferHeader*)((unsigned char*)p - HeaderSize);
+}
+
+// Put a buffer on the shared free list, or release it if the pool is full
+static void ReleaseShared(Pool& pool, BufferHeader* header)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (pool.bytesCached + header->size <= pool.limit) {
+            header->next = pool.freeLists[header->sizeClass];
+            pool.freeLists[header->sizeClass] = header;
+            pool.bytesCached += header->size;
+            return;
+        }
+    }
+    FreeToOS(header);
+}
+
+// Its lock is only ever contended by TrimBufferPool flushing it from another thread
+struct ThreadCache {
+    std::mutex mutex;
+    BufferHeader* heads[MaxClasses] = {};
+    int counts[MaxClasses] = {};
+
+    BufferHeader* Pop(int sizeClass) {
+        std::lock_guard<std::mutex> lock(mutex);
+        BufferHeader* header = heads[sizeClass];
+        if (header) {
+            heads[sizeClass] = header->next;
+            counts[sizeClass]--;
+        }
+        return header;
+    }
+
+    bool Push(BufferHeader* header) {
+        std::lock_guard<std::mutex> lock(mutex);
+        int c = header->sizeClass;
+        if (counts[c] >= ThreadCacheCount)
+            return false;
+        header->next = heads[c];
+        heads[c] = header;
+        counts[c]++;
+        GetPool().bytesCached += header->size;  // Before a trim can flush it
+        return true;
+    }
+
+    // Hand everything to the shared lists, so other threads can use it. Any thread.
+    void Flush() {
+        BufferHeader* lists[MaxClasses];
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            memcpy(lists, heads, sizeof(lists));
+            memset(heads, 0, sizeof(heads));
+            memset(counts, 0, sizeof(counts));
+        }
+        Pool& pool = GetPool();
+        for (BufferHeader* header : lists) {
+            while (header) {
+                BufferHeader* next = header->next;
+                pool.bytesCached -= header->size;
+                ReleaseShared(pool, header);
+                header = next;
+            }
+        }
+    }
+
+    ThreadCache();
+    ~ThreadCache();
+};
+
+static thread_local ThreadCache t_Cache;
+static thread_local bool t_CacheDestroyed = false;     // Buffers freed after thread_local destruction bypass it
+
+ThreadCache::ThreadCache()
+{
+    Pool& pool = GetPool();
+    std::lock_guard<std::mutex> lock(pool.cachesMutex);
+    pool.caches.push_back(this);
+}
+
+ThreadCache::~ThreadCache()
+{
+    Pool& pool = GetPool();
+    {
+        std::lock_guard<std::mutex> lock(pool.cachesMutex);
+        pool.caches.erase(std::find(pool.caches.begin(), pool.caches.end(), this));
+    }
+    Flush();
+    t_CacheDestroyed = true;
+}
+
+void* PoolAlloc(size_t bytes)
+{
+    Pool& pool = GetPool();
+    pool.allocations++;
+    int sizeClass = pool.ClassOf(std::max(bytes, MinClassSize));
+    BufferHeader* header = nullptr;
+
+    if (sizeClass >= 0) {
+        size_t size = pool.classSizes[sizeClass];
+        if (size <= ThreadCacheMaxSize && !t_CacheDestroyed) {
+            header = t_Cache.Pop(sizeClass);
+        }
+        if (!header) {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            header = pool.freeLists[sizeClass];
+            if (header) {
+                pool.freeLists[sizeClass] = header->next;
+            }
+        }
+        if (header) {
+            pool.hits++;
+            pool.bytesCached -= header->size;
+        }
+        else {
+            header = AllocateFromOS(size, sizeClass);
+        }
+    }
+    else {
+        header = AllocateFromOS(bytes, -1);
+    }
+
+    if (!header)
+        return nullptr;
+    pool.bytesInUse += header->size;
+    return DataOf(header);
+}
+
+void PoolFree(void* p)
+{
+    if (!p)
+        return;
+    Pool& pool = GetPool();
+    BufferHeader* header = HeaderOf(p);
+    pool.bytesInUse -= header->size;
+
+    if (header->sizeClass < 0) {
+        FreeToOS(header);
+        return;
+    }
+    if (header->size <= ThreadCacheMaxSize && !t_CacheDestroyed && pool.bytesCached + header->size <= pool.limit && t_Cache.Push(header)) {
+        return;
+    }
+    ReleaseShared(pool, header);
+}
+
+void* PoolRealloc(void* p, size_t bytes)
+{
+    if (!p)
+        return PoolAlloc(bytes);
+    size_t size = HeaderOf(p)->size;
+    if (bytes <= size)
+        return p;
+    void* grown = PoolAlloc(bytes);
+    if (grown) {
+        memcpy(grown, p, size);
+        PoolFree(p);
+    }
+    return grown;
+}
+
+std::shared_ptr<void> PoolAllocShared(size_t bytes, unsigned char** data)
+{
+    unsigned char* p = (unsigned char*)PoolAlloc(bytes);
+    if (!p)
+        return nullptr;
+    if (data)
+        *data = p;
+    return std::shared_ptr<void>(p, PoolFree, PoolAllocator<char>());
+}
+
+void SetBufferPoolLimit(size_t bytes)
+{
+    GetPool().limit = bytes;
+}
+
+void TrimBufferPool()
+{
+    Pool& pool = GetPool();
+    {
+        // Every thread's cache, not just ours: idle workers would otherwise keep theirs
+        std::lock_guard<std::mutex> lock(pool.cachesMutex);
+        for (ThreadCache* cache : pool.caches)
+            cache->Flush();
+    }
+    BufferHeader* lists[MaxClasses];
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        memcpy(lists, pool.freeLists, sizeof(lists));
+        memset(pool.freeLists, 0, sizeof(pool.freeLists));
+    }
+    for (BufferHeader* header : lists) {
+        while (header) {
+            BufferHeader* next = header->next;
+            pool.bytesCached -= header->size;
+            FreeToOS(header);
+            header = next;
+        }
+    }
+}
+
+BufferPoolStats GetBufferPoolStats()
+{
+    Pool& pool = GetPool();
+    BufferPoolStats stats;
+    stats.bytesInUse = pool.bytesInUse;
+    stats.bytesCached = pool.bytesCached;
+    stats.limit = pool.limit;
+    stats.allocations = pool.allocations;
+    stats.hits = pool.hits;
+    return stats;
+}
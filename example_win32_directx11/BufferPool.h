@@ -0,0 +1,83 @@
+// Recycled memory for pixel buffers.
+//
+// Image evaluations allocate and free the same handful of large sizes over and over: decoded
+// frames, strips, previews. The pool rounds every request up to a size class (four per power of
+// two, so at most 25% is wasted) and keeps freed buffers on per-class free lists instead of
+// returning them to the OS. Small buffers are cached per thread first, large ones go straight
+// to a shared list so a buffer freed on the UI thread can be reused by the next worker. Once
+// the working set has been seen, repeated evaluations make no heap allocations at all.
+//
+// Every buffer is 64-byte aligned. A header in front of it records its size class, so buffers
+// are freed without passing the size, like malloc/free, and stb can allocate through the pool.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+void* PoolAlloc(size_t bytes);
+void* PoolRealloc(void* p, size_t bytes);
+void PoolFree(void* p);
+
+// A pooled buffer owned by a shared_ptr, for ImageData::owner. The control block is pooled too.
+// Null if the buffer could not be allocated.
+std::shared_ptr<void> PoolAllocShared(size_t bytes, unsigned char** data);
+
+// Bytes the pool may keep cached for reuse. Freed buffers beyond it go back to the OS.
+void SetBufferPoolLimit(size_t bytes);
+
+// Return every cached buffer to the OS, including those cached by other threads
+void TrimBufferPool();
+
+struct BufferPoolStats {
+    size_t bytesInUse = 0;          // Handed out and not yet freed, rounded up to the size class
+    size_t bytesCached = 0;         // On free lists, ready for reuse
+    size_t limit = 0;
+    unsigned long long allocations = 0;
+    unsigned long long hits = 0;    // Allocations served from a free list
+
+    float HitRate() const { return allocations ? (float)hits / (float)allocations : 0.0f; }
+};
+BufferPoolStats GetBufferPoolStats();
+
+// Move-only owner of a pooled buffer, for scratch memory with a scope
+class PooledBuffer {
+public:
+    PooledBuffer() = default;
+    explicit PooledBuffer(size_t bytes) : ptr((unsigned char*)PoolAlloc(bytes)), length(bytes) {}
+    ~PooledBuffer() { PoolFree(ptr); }
+    PooledBuffer(PooledBuffer&& other) noexcept : ptr(other.ptr), length(other.length) { other.ptr = nullptr; other.length = 0; }
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept {
+        std::swap(ptr, other.ptr);
+        std::swap(length, other.length);
+        return *this;
+    }
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    unsigned char* data() const { return ptr; }
+    size_t size() const { return length; }
+
+private:
+    unsigned char* ptr = nullptr;
+    size_t length = 0;
+};
+
+// Standard allocator on top of the pool, for containers and shared_ptr control blocks
+template <class T>
+struct PoolAllocator {
+    typedef T value_type;
+    PoolAllocator() = default;
+    template <class U> PoolAllocator(const PoolAllocator<U>&) {}
+    T* allocate(size_t n) {
+        void* p = PoolAlloc(n * sizeof(T));
+        if (!p)
+            throw std::bad_alloc();
+        return (T*)p;
+    }
+    void deallocate(T* p, size_t) { PoolFree(p); }
+    template <class U> bool operator==(const PoolAllocator<U>&) const { return true; }
+    template <class U> bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
@@ -0,0 +1,45 @@
+// Cooperative cancellation of background evaluations.
+//
+// Evaluation requests are numbered. Starting a request takes a token from the
+// EvaluationGenerations of whoever owns the result, which bumps the generation and so cancels
+// every token handed out before: a job never has to be told that it was superseded. Jobs check
+// their token between units of work (strips, tiles) and give up at the next one, so a stale job
+// stops within one tile's worth of time however long the whole evaluation would take.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+class CancelToken {
+public:
+    CancelToken() = default;    // Never cancelled
+
+    bool IsCancelled() const { return latest && latest->load(std::memory_order_relaxed) != generation; }
+    unsigned long long Generation() const { return generation; }
+
+private:
+    friend class EvaluationGenerations;
+    std::shared_ptr<const std::atomic<unsigned long long>> latest;
+    unsigned long long generation = 0;
+};
+
+class EvaluationGenerations {
+public:
+    // Start a new generation, cancelling every earlier token
+    CancelToken Next() {
+        CancelToken token;
+        token.generation = ++*latest;
+        token.latest = latest;
+        return token;
+    }
+
+    // Cancel every token handed out so far without starting anything
+    void CancelAll() { ++*latest; }
+
+    // The result of 'generation' is the one to show: nothing newer was requested since
+    bool IsCurrent(unsigned long long generation) const { return latest->load() == generation; }
+
+private:
+    std::shared_ptr<std::atomic<unsigned long long>> latest = std::make_shared<std::atomic<unsigned long long>>(0);
+};
@@ -0,0 +1,49 @@
+// Hands finished results from worker threads to the UI without the UI ever waiting.
+//
+// Workers publish into the back slot; a newer result simply replaces one the UI has not picked
+// up yet. Between frames the UI swaps the back slot to the front, and draws from the front only,
+// so a frame always shows the last completed result while newer work is still running. The
+// lock is held just long enough to move a value, never while anything is computed.
+
+#pragma once
+
+#include <mutex>
+#include <utility>
+
+template <class T>
+class DoubleBuffer {
+public:
+    // Any thread
+    void Publish(T value) {
+        T replaced;     // Released outside the lock
+        std::lock_guard<std::mutex> lock(mutex);
+        replaced = std::move(back);
+        back = std::move(value);
+        hasBack = true;
+    }
+
+    // UI thread: bring the newest published value to the front. False if there was none.
+    bool Swap() {
+        T previous;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!hasBack)
+                return false;
+            previous = std::move(front);
+            front = std::move(back);
+            back = T();
+            hasBack = false;
+        }
+        return true;
+    }
+
+    // UI thread
+    const T& Front() const { return front; }
+    void ResetFront() { front = T(); }
+
+private:
+    std::mutex mutex;
+    T front;
+    T back;
+    bool hasBack = false;
+};
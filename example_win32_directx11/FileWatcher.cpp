@@ -0,0 +1,327 @@
+// Notifies about files changed on disk. See FileWatcher.h
+
+#include "FileWatcher.h"
+#include "UIWake.h"
+#include <algorithm>
+#include <ctype.h>
+#include <set>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Paths are compared with forward slashes, and case-insensitively on Windows
+static std::string NormalizePath(const std::string& path)
+{
+    std::string result = path;
+    for (char& c : result) {
+        if (c == '\\')
+            c = '/';
+#ifdef _WIN32
+        c = (char)tolower((unsigned char)c);
+#endif
+    }
+    return result;
+}
+
+// Directory part of a normalized path, including the trailing slash ("" for the current directory)
+static std::string DirectoryOf(const std::string& normalizedPath)
+{
+    size_t slash = normalizedPath.find_last_of('/');
+    return slash == std::string::npos ? std::string() : normalizedPath.substr(0, slash + 1);
+}
+
+#ifdef _WIN32
+struct FileWatcher::Directory {
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    OVERLAPPED overlapped = {};
+    DWORD buffer[4096];     // FILE_NOTIFY_INFORMATION records, DWORD aligned
+
+    bool Issue() {
+        return ReadDirectoryChangesW(handle, buffer, sizeof(buffer), FALSE,
+                                     FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE,
+                                     nullptr, &overlapped, nullptr) != 0;
+    }
+};
+#else
+struct FileWatcher::Directory {
+    int wd = -1;
+};
+#endif
+
+FileWatcher::FileWatcher(int debounceMs)
+    : debounce(debounceMs)
+{
+#ifdef _WIN32
+    wakeEvent = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+#else
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (pipe(wakePipe) == 0) {
+        fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+    }
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        watched.clear();
+    }
+    if (thread.joinable()) {
+        Wake();
+        thread.join();
+    }
+    SyncDirectories();  // Nothing is watched any more: closes every OS watch
+#ifdef _WIN32
+    CloseHandle(wakeEvent);
+#else
+    if (inotifyFd >= 0)
+        close(inotifyFd);
+    if (wakePipe[0] >= 0) {
+        close(wakePipe[0]);
+        close(wakePipe[1]);
+    }
+#endif
+}
+
+void FileWatcher::Watch(const std::string& path)
+{
+    if (path.empty())
+        return;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string key = NormalizePath(path);
+    if (watched[key]++ == 0) {
+        original[key] = path;
+        watchesChanged = true;
+    }
+    if (!thread.joinable())
+        thread = std::thread([this]() { ThreadMain(); });
+    else
+        Wake();
+}
+
+void FileWatcher::Unwatch(const std::string& path)
+{
+    if (path.empty())
+        return;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string key = NormalizePath(path);
+    auto it = watched.find(key);
+    if (it == watched.end() || --it->second > 0)
+        return;
+    watched.erase(it);
+    original.erase(key);
+    pending.erase(key);
+    watchesChanged = true;
+    Wake();
+}
+
+std::vector<std::string> FileWatcher::PollChanges()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> changes;
+    changes.swap(settled);
+    return changes;
+}
+
+void FileWatcher::OnFileEvent(const std::string& dir, const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Clock::time_point now = Clock::now();
+    if (name.empty()) {
+        // The OS dropped events for this directory: assume all of its files changed
+        for (auto& entry : watched)
+            if (DirectoryOf(entry.first) == dir)
+                pending[entry.first] = now;
+        return;
+    }
+    std::string key = dir + NormalizePath(name);
+    if (watched.count(key))
+        pending[key] = now;     // Restarts the debounce period
+}
+
+void FileWatcher::ThreadMain()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        if (watchesChanged) {
+            watchesChanged = false;
+            lock.unlock();
+            SyncDirectories();
+            lock.lock();
+            continue;
+        }
+
+        // Report the paths that have been quiet long enough, and sleep until the next one is due
+        Clock::time_point now = Clock::now();
+        int timeoutMs = -1;
+        size_t settledBefore = settled.size();
+        for (auto it = pending.begin(); it != pending.end();) {
+            Clock::time_point due = it->second + debounce;
+            if (due <= now) {
+                settled.push_back(original[it->first]);
+                it = pending.erase(it);
+                continue;
+            }
+            int ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count() + 1;
+            timeoutMs = timeoutMs < 0 ? ms : std::min(timeoutMs, ms);
+            ++it;
+        }
+        if (settled.size() != settledBefore)
+            WakeUI();   // The UI may be idle, and only polls for changes when it draws
+
+        lock.unlock();
+        WaitForEvents(timeoutMs);
+        lock.lock();
+    }
+}
+
+void FileWatcher::SyncDirectories()
+{
+    std::set<std::string> wanted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& entry : watched)
+            wanted.insert(DirectoryOf(entry.first));
+    }
+
+    for (auto it = directories.begin(); it != directories.end();) {
+        if (wanted.count(it->first)) {
+            ++it;
+            continue;
+        }
+        Directory* d = it->second;
+#ifdef _WIN32
+        if (d->handle != INVALID_HANDLE_VALUE) {
+            DWORD bytes;
+            CancelIo(d->handle);
+            GetOverlappedResult(d->handle, &d->overlapped, &bytes, TRUE);
+            CloseHandle(d->handle);
+        }
+        CloseHandle(d->overlapped.hEvent);
+#else
+        if (d->wd >= 0)
+            inotify_rm_watch(inotifyFd, d->wd);
+#endif
+        delete d;
+        it = directories.erase(it);
+    }
+
+    for (const std::string& dir : wanted) {
+        if (directories.count(dir))
+            continue;
+        std::string osPath = dir.empty() ? std::string(".") : dir;
+        Directory* d = new Directory();
+#ifdef _WIN32
+        d->overlapped.hEvent = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+        d->handle = CreateFileA(osPath.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+        if (d->handle != INVALID_HANDLE_VALUE && !d->Issue()) {
+            CloseHandle(d->handle);
+            d->handle = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (inotifyFd >= 0)
+            d->wd = inotify_add_watch(inotifyFd, osPath.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+#endif
+        directories[dir] = d;
+    }
+}
+
+void FileWatcher::Wake()
+{
+#ifdef _WIN32
+    SetEvent(wakeEvent);
+#else
+    if (wakePipe[1] >= 0) {
+        char c = 0;
+        (void)!write(wakePipe[1], &c, 1);
+    }
+#endif
+}
+
+#ifdef _WIN32
+void FileWatcher::WaitForEvents(int timeoutMs)
+{
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    std::string dirs[MAXIMUM_WAIT_OBJECTS];
+    DWORD count = 0;
+    handles[count++] = wakeEvent;
+    for (auto& entry : directories) {
+        if (entry.second->handle == INVALID_HANDLE_VALUE || count == MAXIMUM_WAIT_OBJECTS)
+            continue;
+        dirs[count] = entry.first;
+        handles[count++] = entry.second->overlapped.hEvent;
+    }
+
+    DWORD result = WaitForMultipleObjects(count, handles, FALSE, timeoutMs < 0 ? INFINITE : (DWORD)timeoutMs);
+    if (result <= WAIT_OBJECT_0 || result >= WAIT_OBJECT_0 + count)
+        return;     // Woken up, timed out or failed
+
+    const std::string& dir = dirs[result - WAIT_OBJECT_0];
+    Directory* d = directories[dir];
+    DWORD bytes = 0;
+    if (!GetOverlappedResult(d->handle, &d->overlapped, &bytes, FALSE))
+        return;
+    if (bytes == 0) {
+        OnFileEvent(dir, "");   // Buffer overflow: the individual changes are lost
+    }
+    else {
+        const unsigned char* p = (const unsigned char*)d->buffer;
+        for (;;) {
+            const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)p;
+            std::wstring wname(info->FileName, info->FileNameLength / sizeof(WCHAR));
+            OnFileEvent(dir, std::string(wname.begin(), wname.end()));
+            if (info->NextEntryOffset == 0)
+                break;
+            p += info->NextEntryOffset;
+        }
+    }
+    d->Issue();
+}
+#else
+void FileWatcher::WaitForEvents(int timeoutMs)
+{
+    struct pollfd fds[2] = { { inotifyFd, POLLIN, 0 }, { wakePipe[0], POLLIN, 0 } };
+    if (poll(fds, 2, timeoutMs) <= 0)
+        return;
+
+    char drain[64];
+    while (read(wakePipe[0], drain, sizeof(drain)) > 0) {
+    }
+
+    alignas(struct inotify_event) char buffer[4096];
+    ssize_t length;
+    while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + length;) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Not tied to a directory (wd is -1): the queue overflowed and any of them may
+                // have lost events
+                for (auto& entry : directories)
+                    OnFileEvent(entry.first, "");
+            }
+            else if (event->len > 0) {
+                for (auto& entry : directories)
+                    if (entry.second->wd == event->wd)
+                        OnFileEvent(entry.first, event->name);
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+#endif
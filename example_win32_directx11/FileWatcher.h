@@ -0,0 +1,59 @@
+// Notifies about files changed on disk by other programs, so inputs can be hot reloaded.
+//
+// The containing directories are watched rather than the files themselves (ReadDirectoryChangesW
+// on Windows, inotify elsewhere), because many editors save by writing a temporary file and
+// renaming it over the original. Changes are debounced: a path is reported once it has been
+// quiet for the debounce period, so a burst of saves results in a single reload.
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FileWatcher {
+public:
+    explicit FileWatcher(int debounceMs = 250);
+    ~FileWatcher();
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Watches are counted, so several nodes can watch the same file
+    void Watch(const std::string& path);
+    void Unwatch(const std::string& path);
+
+    // Paths that changed and have settled since the last call. Cheap enough to call every frame.
+    std::vector<std::string> PollChanges();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void ThreadMain();
+    void Wake();
+    void SyncDirectories();                     // Watcher thread: match OS watches to 'watched'
+    void WaitForEvents(int timeoutMs);          // Watcher thread: block for events, then record them
+    void OnFileEvent(const std::string& dir, const std::string& name);
+
+    std::mutex mutex;
+    std::map<std::string, int> watched;         // Normalized path -> watch count
+    std::map<std::string, std::string> original;    // Normalized path -> path as given
+    std::map<std::string, Clock::time_point> pending;   // Changed, waiting to settle
+    std::vector<std::string> settled;
+    bool watchesChanged = false;
+    bool stopping = false;
+    std::chrono::milliseconds debounce;
+    std::thread thread;
+
+    // OS state, only touched by the watcher thread (and the constructor/destructor)
+    struct Directory;
+    std::map<std::string, Directory*> directories;
+#ifdef _WIN32
+    void* wakeEvent = nullptr;
+#else
+    int inotifyFd = -1;
+    int wakePipe[2] = { -1, -1 };
+#endif
+};
@@ -0,0 +1,49 @@
+// CPU image memory. See ImageBuffer.h
+
+#include "ImageBuffer.h"
+#include "BufferPool.h"
+#include <limits.h>
+#include <stdint.h>
+
+int BytesPerPixel(PixelFormat format)
+{
+    return format == PixelFormat_RGBA32F ? 16 : 4;
+}
+
+int AlignedStride(int width, PixelFormat format)
+{
+    int rowBytes = width * BytesPerPixel(format);
+    return (rowBytes + ImageRowAlignment - 1) / ImageRowAlignment * ImageRowAlignment;
+}
+
+bool ImageBuffer::Allocate(int w, int h, PixelFormat f)
+{
+    *this = ImageBuffer();
+    if (w <= 0 || h <= 0 || w > (INT_MAX - ImageRowAlignment) / BytesPerPixel(f))
+        return false;
+    int alignedStride = AlignedStride(w, f);
+    std::shared_ptr<void> memory = PoolAllocShared((size_t)alignedStride * h, &pixels);
+    if (!memory) {
+        pixels = nullptr;
+        return false;
+    }
+    width = w;
+    height = h;
+    format = f;
+    stride = alignedStride;
+    owner = std::move(memory);
+    return true;
+}
+
+ImageBuffer ImageBuffer::Rows(int first, int count) const
+{
+    ImageBuffer rows = *this;
+    rows.pixels = Row(first);
+    rows.height = count;
+    return rows;
+}
+
+bool ImageBuffer::IsAligned() const
+{
+    return (uintptr_t)pixels % ImageRowAlignment == 0 && stride % ImageRowAlignment == 0 && (size_t)stride >= RowBytes();
+}
@@ -0,0 +1,49 @@
+// CPU image memory with a layout that suits vector loops.
+//
+// Rows start on 64-byte boundaries and the stride is a whole number of cache lines, so no two
+// rows share a line (threads working on neighbouring rows never false-share) and every row is
+// followed by padding up to the next line. A loop may process a row in full 16, 32 or 64 byte
+// vectors and run past the last pixel into the padding, without a scalar epilogue. The padding
+// holds garbage: write to it freely, never expect anything from it.
+//
+// An ImageBuffer is writable and shares its pixels between copies, like ImageData. Any
+// ImageBuffer converts to an ImageData view, so read-only APIs take both.
+
+#pragma once
+
+#include <memory>
+
+enum PixelFormat {
+    PixelFormat_RGBA8 = 0,      // What every decoder produces and every encoder consumes
+    PixelFormat_RGBA32F,        // Linear float, for kernels that need the headroom
+};
+
+int BytesPerPixel(PixelFormat format);
+
+// Every buffer allocated here is aligned to this, and so are its strides
+static const int ImageRowAlignment = 64;
+
+// Bytes between rows of a 'width' pixel wide buffer: the row rounded up to whole cache lines
+int AlignedStride(int width, PixelFormat format);
+
+struct ImageBuffer {
+    int width = 0;
+    int height = 0;
+    int stride = 0;                     // Bytes between rows, a multiple of ImageRowAlignment when allocated here
+    PixelFormat format = PixelFormat_RGBA8;
+    unsigned char* pixels = nullptr;
+    std::shared_ptr<void> owner;
+
+    // Replace the contents with a new uninitialized image from the buffer pool. False, leaving
+    // the buffer empty, if the size is out of range or the memory is not there.
+    bool Allocate(int width, int height, PixelFormat format = PixelFormat_RGBA8);
+
+    unsigned char* Row(int y) const { return pixels + (size_t)y * stride; }
+    size_t RowBytes() const { return (size_t)width * BytesPerPixel(format); }
+
+    // Rows [first, first + count) as an image of their own, sharing these pixels
+    ImageBuffer Rows(int first, int count) const;
+
+    // True when rows are aligned and padded as described above
+    bool IsAligned() const;
+};
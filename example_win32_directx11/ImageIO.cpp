@@ -0,0 +1,2418 @@
+// Image file readers and writers used by the node editor. See ImageIO.h
+
+#include "ImageIO.h"
+#include "BufferPool.h"
+#include "ScratchArena.h"
+#include "ThreadPool.h"
+#include "stb/stb_image.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//-----------------------------------------------------------------------------
+// Helpers
+//-----------------------------------------------------------------------------
+
+static int ResolveThreadCount(int numThreads)
+{
+    return numThreads > 0 ? numThreads : GetThreadPoolSize();
+}
+
+static void PutU32LE(std::vector<unsigned char>& out, unsigned int v)
+{
+    out.push_back((unsigned char)v);
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 24));
+}
+
+static unsigned int GetU32LE(const unsigned char* p)
+{
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned int GetU32BE(const unsigned char* p)
+{
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | (unsigned int)p[3];
+}
+
+// Allocate an RGBA8 image with aligned, padded rows, owned by 'out'. Pixels are left
+// uninitialized; rows are out.stride bytes apart. Null if it could not be allocated.
+static unsigned char* AllocateImage(ImageData& out, int width, int height)
+{
+    ImageBuffer buffer;
+    if (!buffer.Allocate(width, height))
+        return nullptr;
+    out = buffer;
+    return buffer.pixels;
+}
+
+static bool WriteFileBytes(const std::string& path, const std::vector<unsigned char>& bytes)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    ok = (fclose(f) == 0) && ok;
+    return ok;
+}
+
+static void PutU32BE(std::vector<unsigned char>& out, unsigned int v)
+{
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+//-----------------------------------------------------------------------------
+// Checksums
+//-----------------------------------------------------------------------------
+
+struct CrcTable {
+    unsigned int entries[256];
+    CrcTable() {
+        for (unsigned int n = 0; n < 256; n++) {
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[n] = c;
+        }
+    }
+};
+
+static unsigned int UpdateCrc32(unsigned int crc, const unsigned char* data, size_t len)
+{
+    static const CrcTable table;
+    unsigned int c = crc ^ 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++)
+        c = table.entries[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+static const unsigned int AdlerBase = 65521;
+
+static unsigned int UpdateAdler32(unsigned int adler, const unsigned char* data, size_t len)
+{
+    unsigned int a = adler & 0xFFFF, b = adler >> 16;
+    while (len > 0) {
+        size_t block = len < 5552 ? len : 5552;   // Largest n such that b cannot overflow
+        len -= block;
+        while (block--) {
+            a += *data++;
+            b += a;
+        }
+        a %= AdlerBase;
+        b %= AdlerBase;
+    }
+    return (b << 16) | a;
+}
+
+// Adler-32 of A+B given adler(A), adler(B) and len(B), so chunks can be summed independently
+static unsigned int CombineAdler32(unsigned int adler1, unsigned int adler2, size_t len2)
+{
+    unsigned int rem = (unsigned int)(len2 % AdlerBase);
+    unsigned int sum1 = adler1 & 0xFFFF;
+    unsigned int sum2 = (unsigned int)(((unsigned long long)rem * sum1) % AdlerBase);
+    sum1 += (adler2 & 0xFFFF) + AdlerBase - 1;
+    sum2 += ((adler1 >> 16) & 0xFFFF) + ((adler2 >> 16) & 0xFFFF) + AdlerBase - rem;
+    if (sum1 >= AdlerBase) sum1 -= AdlerBase;
+    if (sum1 >= AdlerBase) sum1 -= AdlerBase;
+    if (sum2 >= (AdlerBase << 1)) sum2 -= (AdlerBase << 1);
+    if (sum2 >= AdlerBase) sum2 -= AdlerBase;
+    return sum1 | (sum2 << 16);
+}
+
+//-----------------------------------------------------------------------------
+// Deflate (RFC 1951)
+//-----------------------------------------------------------------------------
+
+static const unsigned short LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned short DistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char DistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static unsigned int ReverseBits(unsigned int code, int len)
+{
+    unsigned int r = 0;
+    for (int i = 0; i < len; i++, code >>= 1)
+        r = (r << 1) | (code & 1);
+    return r;
+}
+
+// Fixed Huffman codes (RFC 1951 3.2.6), stored bit-reversed so they can be emitted LSB first
+struct FixedHuffmanTables {
+    unsigned short litCode[288];
+    unsigned char litLen[288];
+    unsigned char lengthSymbol[259];   // match length -> index into LengthBase
+    unsigned char distSymbol[512];     // see DistanceSymbol()
+
+    FixedHuffmanTables() {
+        for (int s = 0; s < 288; s++) {
+            unsigned int code; int len;
+            if (s < 144)      { code = 0x30 + s;           len = 8; }
+            else if (s < 256) { code = 0x190 + (s - 144);  len = 9; }
+            else if (s < 280) { code = s - 256;            len = 7; }
+            else              { code = 0xC0 + (s - 280);   len = 8; }
+            litCode[s] = (unsigned short)ReverseBits(code, len);
+            litLen[s] = (unsigned char)len;
+        }
+        for (int i = 0; i < 29; i++) {
+            int count = (i == 28) ? 1 : (1 << LengthExtra[i]);
+            for (int l = LengthBase[i]; l < LengthBase[i] + count && l <= 258; l++)
+                lengthSymbol[l] = (unsigned char)i;
+        }
+        for (int i = 0; i < 30; i++) {
+            for (int d = DistBase[i]; d < DistBase[i] + (1 << DistExtra[i]); d++) {
+                if (d - 1 < 256)
+                    distSymbol[d - 1] = (unsigned char)i;
+                else
+                    distSymbol[256 + ((d - 1) >> 7)] = (unsigned char)i;
+            }
+        }
+    }
+
+    int DistanceSymbol(int dist) const {
+        return (dist - 1 < 256) ? distSymbol[dist - 1] : distSymbol[256 + ((dist - 1) >> 7)];
+    }
+};
+
+static const FixedHuffmanTables& GetFixedHuffman()
+{
+    static const FixedHuffmanTables tables;
+    return tables;
+}
+
+struct BitWriter {
+    std::vector<unsigned char>& out;
+    unsigned long long bitBuffer = 0;
+    int bitCount = 0;
+
+    explicit BitWriter(std::vector<unsigned char>& o) : out(o) {}
+
+    void PutBits(unsigned int bits, int count) {
+        bitBuffer |= (unsigned long long)bits << bitCount;
+        bitCount += count;
+        while (bitCount >= 8) {
+            out.push_back((unsigned char)bitBuffer);
+            bitBuffer >>= 8;
+            bitCount -= 8;
+        }
+    }
+
+    void AlignToByte() {
+        if (bitCount > 0)
+            PutBits(0, 8 - bitCount);
+    }
+};
+
+// Finish a chunk so the next one can be appended as-is: the last chunk gets an empty final
+// block, every other chunk an empty stored block which also pads to a byte boundary.
+static void EndDeflateChunk(BitWriter& bw, bool last)
+{
+    if (last) {
+        const FixedHuffmanTables& huff = GetFixedHuffman();
+        bw.PutBits(1, 1);   // BFINAL
+        bw.PutBits(1, 2);   // BTYPE = fixed Huffman
+        bw.PutBits(huff.litCode[256], huff.litLen[256]);
+        bw.AlignToByte();
+    }
+    else {
+        bw.PutBits(0, 1);
+        bw.PutBits(0, 2);   // BTYPE = stored
+        bw.AlignToByte();
+        bw.PutBits(0x0000, 16);
+        bw.PutBits(0xFFFF, 16);
+    }
+}
+
+// Deflate data[begin, end) as stored blocks
+static void DeflateStored(const unsigned char* data, size_t begin, size_t end, bool last, std::vector<unsigned char>& out)
+{
+    out.reserve(end - begin + (end - begin) / 65535 * 5 + 16);
+    size_t pos = begin;
+    do {
+        size_t len = end - pos < 65535 ? end - pos : 65535;
+        bool final = last && pos + len == end;
+        out.push_back(final ? 1 : 0);
+        out.push_back((unsigned char)len);
+        out.push_back((unsigned char)(len >> 8));
+        out.push_back((unsigned char)~len);
+        out.push_back((unsigned char)(~len >> 8));
+        out.insert(out.end(), data + pos, data + pos + len);
+        pos += len;
+    } while (pos < end);
+    if (!last) {
+        BitWriter bw(out);
+        EndDeflateChunk(bw, false);
+    }
+}
+
+// Deflate data[begin, end) as one fixed-Huffman block. Matches may reach back into the 32 KB
+// preceding 'begin', which keeps the ratio close to a single-stream encoder.
+static void DeflateFast(const unsigned char* data, size_t begin, size_t end, bool last, std::vector<unsigned char>& out)
+{
+    const int HashBits = 15;
+    const int WindowSize = 32768;
+    const int MinMatch = 4;
+    const int MaxMatch = 258;
+    const int MaxChain = 16;
+    const FixedHuffmanTables& huff = GetFixedHuffman();
+
+    // Hash chains are scratch: a chunk's tables die with it
+    ScratchScope scope;
+    int* head = ScratchArena::ForThread().AllocateArray<int>((size_t)1 << HashBits);
+    int* prev = ScratchArena::ForThread().AllocateArray<int>(WindowSize);
+    std::fill(head, head + ((size_t)1 << HashBits), -1);
+    std::fill(prev, prev + WindowSize, -1);
+    size_t dictStart = begin > (size_t)WindowSize ? begin - WindowSize : 0;
+    const unsigned char* base = data + dictStart;    // Positions below are relative to dictStart
+    int start = (int)(begin - dictStart);
+    int limit = (int)(end - dictStart);
+
+    auto hashAt = [&](int p) {
+        unsigned int v;
+        memcpy(&v, base + p, 4);
+        return (v * 2654435761u) >> (32 - HashBits);
+    };
+    auto insert = [&](int p) {
+        if (p + MinMatch > limit)
+            return;
+        unsigned int h = hashAt(p);
+        prev[p & (WindowSize - 1)] = head[h];
+        head[h] = p;
+    };
+
+    for (int p = 0; p < start; p++)
+        insert(p);
+
+    out.reserve((end - begin) + (end - begin) / 8 + 64);
+    BitWriter bw(out);
+    bw.PutBits(0, 1);   // BFINAL stays 0, the stream is closed by EndDeflateChunk
+    bw.PutBits(1, 2);   // BTYPE = fixed Huffman
+
+    int p = start;
+    while (p < limit) {
+        int bestLen = 0, bestDist = 0;
+        if (p + MinMatch <= limit) {
+            int maxLen = limit - p < MaxMatch ? limit - p : MaxMatch;
+            int candidate = head[hashAt(p)];
+            for (int chain = 0; candidate >= 0 && p - candidate <= WindowSize && chain < MaxChain; chain++) {
+                if (base[candidate + bestLen] == base[p + bestLen]) {
+                    int len = 0;
+                    while (len < maxLen && base[candidate + len] == base[p + len])
+                        len++;
+                    if (len > bestLen) {
+                        bestLen = len;
+                        bestDist = p - candidate;
+                        if (len == maxLen)
+                            break;
+                    }
+                }
+                int next = prev[candidate & (WindowSize - 1)];
+                if (next >= candidate)
+                    break;  // Slot was recycled by a newer position
+                candidate = next;
+            }
+        }
+
+        if (bestLen >= MinMatch) {
+            int ls = huff.lengthSymbol[bestLen];
+            bw.PutBits(huff.litCode[257 + ls], huff.litLen[257 + ls]);
+            if (LengthExtra[ls])
+                bw.PutBits(bestLen - LengthBase[ls], LengthExtra[ls]);
+            int ds = huff.DistanceSymbol(bestDist);
+            bw.PutBits(ReverseBits(ds, 5), 5);
+            if (DistExtra[ds])
+                bw.PutBits(bestDist - DistBase[ds], DistExtra[ds]);
+
+            // Index the covered positions too, except inside long runs where it buys little
+            int indexed = bestLen <= 32 ? bestLen : 1;
+            for (int i = 0; i < indexed; i++)
+                insert(p + i);
+            p += bestLen;
+        }
+        else {
+            bw.PutBits(huff.litCode[base[p]], huff.litLen[base[p]]);
+            insert(p);
+            p++;
+        }
+    }
+    bw.PutBits(huff.litCode[256], huff.litLen[256]);   // End of block
+    EndDeflateChunk(bw, last);
+}
+
+//-----------------------------------------------------------------------------
+// PNG
+//-----------------------------------------------------------------------------
+
+static unsigned char Paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return (unsigned char)a;
+    if (pb <= pc) return (unsigned char)b;
+    return (unsigned char)c;
+}
+
+// Apply PNG filter 'type' to one row. 'prev' is the unfiltered previous row or nullptr.
+static void FilterRow(int type, const unsigned char* cur, const unsigned char* prev, int rowBytes, int bpp, unsigned char* out)
+{
+    for (int i = 0; i < rowBytes; i++) {
+        int a = i >= bpp ? cur[i - bpp] : 0;
+        int b = prev ? prev[i] : 0;
+        int c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+        int pred = 0;
+        switch (type) {
+        case 1: pred = a; break;
+        case 2: pred = b; break;
+        case 3: pred = (a + b) >> 1; break;
+        case 4: pred = Paeth(a, b, c); break;
+        }
+        out[i] = (unsigned char)(cur[i] - pred);
+    }
+}
+
+// Pick the filter with the smallest sum of absolute residuals (libpng's heuristic)
+static void FilterRowAdaptive(const unsigned char* cur, const unsigned char* prev, int rowBytes, int bpp, unsigned char* out, unsigned char* scratch)
+{
+    unsigned long long bestScore = ~0ull;
+    int bestType = 0;
+    for (int type = 0; type < 5; type++) {
+        FilterRow(type, cur, prev, rowBytes, bpp, scratch);
+        unsigned long long score = 0;
+        for (int i = 0; i < rowBytes; i++)
+            score += (unsigned long long)abs((int)(signed char)scratch[i]);
+        if (score < bestScore) {
+            bestScore = score;
+            bestType = type;
+        }
+    }
+    out[0] = (unsigned char)bestType;
+    FilterRow(bestType, cur, prev, rowBytes, bpp, out + 1);
+}
+
+static void WritePngChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t len)
+{
+    PutU32BE(out, (unsigned int)len);
+    size_t crcStart = out.size();
+    out.insert(out.end(), type, type + 4);
+    if (len)
+        out.insert(out.end(), data, data + len);
+    PutU32BE(out, UpdateCrc32(0, &out[crcStart], len + 4));
+}
+
+struct DeflateChunk {
+    size_t begin = 0, end = 0;
+    std::vector<unsigned char> idat;   // Complete IDAT chunk: length, type, deflate bytes, CRC
+    unsigned int adler = 1;
+};
+
+// Filter 'rowCount' rows into 'filtered' (rowBytes + 1 bytes per row). 'prevRow' is the unfiltered
+// row above the first one, or nullptr at the top of the image. Each row only depends on the
+// unfiltered previous row, so bands run in parallel.
+static void FilterRows(const unsigned char* rgba, int stride, int width, int rowCount, const unsigned char* prevRow,
+                       PngCompression level, int numThreads, unsigned char* filtered)
+{
+    const int bpp = 4;
+    const int rowBytes = width * bpp;
+    const size_t filteredStride = (size_t)rowBytes + 1;
+    const int RowsPerBand = 64;
+    int numBands = (rowCount + RowsPerBand - 1) / RowsPerBand;
+    ParallelFor(numBands, [&](int band) {
+        ScratchScope scope;
+        unsigned char* scratch = ScratchArena::ForThread().AllocateArray<unsigned char>(rowBytes);
+        int yEnd = (band + 1) * RowsPerBand < rowCount ? (band + 1) * RowsPerBand : rowCount;
+        for (int y = band * RowsPerBand; y < yEnd; y++) {
+            const unsigned char* cur = rgba + (size_t)y * stride;
+            unsigned char* dst = filtered + filteredStride * y;
+            if (level == PngCompression_Store) {
+                dst[0] = 0;
+                memcpy(dst + 1, cur, rowBytes);
+            }
+            else {
+                const unsigned char* prev = y > 0 ? cur - stride : prevRow;
+                FilterRowAdaptive(cur, prev, rowBytes, bpp, dst, scratch);
+            }
+        }
+    }, numThreads);
+}
+
+// Deflate data[begin, end) as independent chunks, a few per thread to keep the load balanced.
+// 'last' ends the deflate stream with the final chunk.
+static void DeflateChunks(const unsigned char* data, size_t begin, size_t end, bool last, PngCompression level, int numThreads,
+                          std::vector<DeflateChunk>& chunks)
+{
+    const size_t MinChunkSize = 256 * 1024;
+    size_t total = end - begin;
+    size_t chunkSize = total / ((size_t)numThreads * 4);
+    if (chunkSize < MinChunkSize)
+        chunkSize = MinChunkSize;
+    int numChunks = (int)((total + chunkSize - 1) / chunkSize);
+    chunks.clear();
+    chunks.resize(numChunks);
+    ParallelFor(numChunks, [&](int i) {
+        DeflateChunk& chunk = chunks[i];
+        chunk.begin = begin + (size_t)i * chunkSize;
+        chunk.end = chunk.begin + chunkSize < end ? chunk.begin + chunkSize : end;
+        bool final = last && i == numChunks - 1;
+
+        std::vector<unsigned char> deflated;
+        if (level == PngCompression_Store)
+            DeflateStored(data, chunk.begin, chunk.end, final, deflated);
+        else
+            DeflateFast(data, chunk.begin, chunk.end, final, deflated);
+        WritePngChunk(chunk.idat, "IDAT", deflated.data(), deflated.size());
+        chunk.adler = UpdateAdler32(1, data + chunk.begin, chunk.end - chunk.begin);
+    }, numThreads);
+}
+
+static const unsigned char PngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+// Signature, IHDR and the zlib header, which goes in its own IDAT so the deflate chunks can follow as-is
+static void WritePngHeader(std::vector<unsigned char>& out, int width, int height)
+{
+    out.insert(out.end(), PngSignature, PngSignature + 8);
+
+    std::vector<unsigned char> ihdr;
+    PutU32BE(ihdr, (unsigned int)width);
+    PutU32BE(ihdr, (unsigned int)height);
+    ihdr.push_back(8);  // Bit depth
+    ihdr.push_back(6);  // Color type RGBA
+    ihdr.push_back(0);  // Compression
+    ihdr.push_back(0);  // Filter method
+    ihdr.push_back(0);  // No interlace
+    WritePngChunk(out, "IHDR", ihdr.data(), ihdr.size());
+
+    const unsigned char ZlibHeader[2] = { 0x78, 0x01 };
+    WritePngChunk(out, "IDAT", ZlibHeader, 2);
+}
+
+// Adler-32 of the whole zlib stream in its own IDAT, then IEND
+static void WritePngTrailer(std::vector<unsigned char>& out, unsigned int adler)
+{
+    std::vector<unsigned char> trailer;
+    PutU32BE(trailer, adler);
+    WritePngChunk(out, "IDAT", trailer.data(), trailer.size());
+    WritePngChunk(out, "IEND", nullptr, 0);
+}
+
+bool EncodePNG(std::vector<unsigned char>& out, const unsigned char* rgba, int width, int height, int stride,
+               PngCompression level, int numThreads)
+{
+    if (!rgba || width <= 0 || height <= 0)
+        return false;
+    numThreads = ResolveThreadCount(numThreads);
+
+    const size_t filteredStride = (size_t)width * 4 + 1;
+    std::vector<unsigned char> filtered(filteredStride * height);
+    FilterRows(rgba, stride, width, height, nullptr, level, numThreads, filtered.data());
+    std::vector<DeflateChunk> chunks;
+    DeflateChunks(filtered.data(), 0, filtered.size(), true, level, numThreads, chunks);
+
+    // The zlib stream spans all IDAT chunks: header, one chunk per deflate job, Adler-32
+    out.clear();
+    WritePngHeader(out, width, height);
+    unsigned int adler = 1;
+    for (const DeflateChunk& chunk : chunks) {
+        out.insert(out.end(), chunk.idat.begin(), chunk.idat.end());
+        adler = CombineAdler32(adler, chunk.adler, chunk.end - chunk.begin);
+    }
+    WritePngTrailer(out, adler);
+    return true;
+}
+
+bool WritePNG(const std::string& path, const unsigned char* rgba, int width, int height, int stride,
+              PngCompression level, int numThreads)
+{
+    std::vector<unsigned char> encoded;
+    if (!EncodePNG(encoded, rgba, width, height, stride, level, numThreads))
+        return false;
+    return WriteFileBytes(path, encoded);
+}
+
+//-----------------------------------------------------------------------------
+// QOI (https://qoiformat.org/qoi-specification.pdf)
+//-----------------------------------------------------------------------------
+
+enum {
+    QOI_OP_INDEX = 0x00,
+    QOI_OP_DIFF = 0x40,
+    QOI_OP_LUMA = 0x80,
+    QOI_OP_RUN = 0xC0,
+    QOI_OP_RGB = 0xFE,
+    QOI_OP_RGBA = 0xFF,
+    QOI_MASK_2 = 0xC0,
+};
+static const int QoiHeaderSize = 14;
+static const unsigned char QoiPadding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+static const int QoiMaxRun = 62;   // Pixels in the longest QOI_OP_RUN
+
+struct QoiPixel {
+    unsigned char r, g, b, a;
+    bool operator==(const QoiPixel& o) const { return r == o.r && g == o.g && b == o.b && a == o.a; }
+};
+
+static int QoiHash(const QoiPixel& px)
+{
+    return (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) & 63;
+}
+
+// Encoder state carries across rows, so an image can be encoded a strip at a time
+struct QoiEncoder {
+    QoiPixel index[64] = {};
+    QoiPixel prev = { 0, 0, 0, 255 };
+    int run = 0;
+
+    // Encode one row into 'bytes', which needs room for 5 bytes per pixel. Returns the bytes written.
+    size_t EncodeRow(const unsigned char* row, int width, unsigned char* bytes) {
+        size_t p = 0;
+        for (int x = 0; x < width; x++) {
+            QoiPixel px = { row[x * 4 + 0], row[x * 4 + 1], row[x * 4 + 2], row[x * 4 + 3] };
+            if (px == prev) {
+                run++;
+                if (run == QoiMaxRun) {
+                    bytes[p++] = (unsigned char)(QOI_OP_RUN | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                bytes[p++] = (unsigned char)(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+
+            int hash = QoiHash(px);
+            if (index[hash] == px) {
+                bytes[p++] = (unsigned char)(QOI_OP_INDEX | hash);
+            }
+            else {
+                index[hash] = px;
+                if (px.a == prev.a) {
+                    signed char vr = (signed char)(px.r - prev.r);
+                    signed char vg = (signed char)(px.g - prev.g);
+                    signed char vb = (signed char)(px.b - prev.b);
+                    signed char vgr = (signed char)(vr - vg);
+                    signed char vgb = (signed char)(vb - vg);
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                        bytes[p++] = (unsigned char)(QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                    }
+                    else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+                        bytes[p++] = (unsigned char)(QOI_OP_LUMA | (vg + 32));
+                        bytes[p++] = (unsigned char)((vgr + 8) << 4 | (vgb + 8));
+                    }
+                    else {
+                        bytes[p++] = QOI_OP_RGB;
+                        bytes[p++] = px.r;
+                        bytes[p++] = px.g;
+                        bytes[p++] = px.b;
+                    }
+                }
+                else {
+                    bytes[p++] = QOI_OP_RGBA;
+                    bytes[p++] = px.r;
+                    bytes[p++] = px.g;
+                    bytes[p++] = px.b;
+                    bytes[p++] = px.a;
+                }
+            }
+            prev = px;
+        }
+        return p;
+    }
+
+    // Flush a pending run and append the end marker
+    size_t Finish(unsigned char* bytes) {
+        size_t p = 0;
+        if (run > 0)
+            bytes[p++] = (unsigned char)(QOI_OP_RUN | (run - 1));
+        run = 0;
+        memcpy(bytes + p, QoiPadding, sizeof(QoiPadding));
+        return p + sizeof(QoiPadding);
+    }
+};
+
+static void WriteQoiHeader(unsigned char* bytes, int width, int height)
+{
+    memcpy(bytes, "qoif", 4);
+    bytes[4] = (unsigned char)(width >> 24); bytes[5] = (unsigned char)(width >> 16); bytes[6] = (unsigned char)(width >> 8); bytes[7] = (unsigned char)width;
+    bytes[8] = (unsigned char)(height >> 24); bytes[9] = (unsigned char)(height >> 16); bytes[10] = (unsigned char)(height >> 8); bytes[11] = (unsigned char)height;
+    bytes[12] = 4;      // Channels
+    bytes[13] = 0;      // sRGB with linear alpha
+}
+
+bool EncodeQOI(std::vector<unsigned char>& out, const unsigned char* rgba, int width, int height, int stride)
+{
+    if (!rgba || width <= 0 || height <= 0)
+        return false;
+
+    // Worst case is one QOI_OP_RGBA (5 bytes) per pixel
+    out.resize(QoiHeaderSize + (size_t)width * height * 5 + 1 + sizeof(QoiPadding));
+    WriteQoiHeader(out.data(), width, height);
+    size_t p = QoiHeaderSize;
+    QoiEncoder encoder;
+    for (int y = 0; y < height; y++)
+        p += encoder.EncodeRow(rgba + (size_t)y * stride, width, out.data() + p);
+    p += encoder.Finish(out.data() + p);
+    out.resize(p);
+    return true;
+}
+
+static bool DecodeQOI(const unsigned char* data, size_t size, ImageData& out, std::atomic<float>* progress)
+{
+    if (size < QoiHeaderSize + sizeof(QoiPadding) || memcmp(data, "qoif", 4) != 0)
+        return false;
+    unsigned int width = GetU32BE(data + 4);
+    unsigned int height = GetU32BE(data + 8);
+    int channels = data[12];
+    if (width == 0 || height == 0 || width > 0x7FFFFFFF / 4 || height > 0x7FFFFFFF || (channels != 3 && channels != 4))
+        return false;
+    // No chunk encodes more than 62 pixels, so a header claiming more than the chunks could
+    // hold is corrupt or truncated; don't allocate for it
+    size_t pixelCount = (size_t)width * height;
+    size_t chunksEnd = size - sizeof(QoiPadding);
+    if ((pixelCount + QoiMaxRun - 1) / QoiMaxRun > chunksEnd - QoiHeaderSize)
+        return false;
+
+    unsigned char* dst = AllocateImage(out, (int)width, (int)height);
+    if (!dst)
+        return false;
+    size_t p = QoiHeaderSize;
+
+    QoiPixel index[64] = {};
+    QoiPixel px = { 0, 0, 0, 255 };
+    int run = 0;
+    unsigned char* row = dst;
+    unsigned int x = 0;
+    for (size_t i = 0; i < pixelCount; i++) {
+        if (progress && (i & 0xFFFFF) == 0)
+            progress->store((float)i / pixelCount, std::memory_order_relaxed);
+        if (x == width) {
+            row += out.stride;
+            x = 0;
+        }
+        if (run > 0) {
+            run--;
+        }
+        else if (p < chunksEnd) {
+            int b1 = data[p++];
+            if (b1 == QOI_OP_RGB) {
+                if (p + 3 > chunksEnd) return false;
+                px.r = data[p++]; px.g = data[p++]; px.b = data[p++];
+            }
+            else if (b1 == QOI_OP_RGBA) {
+                if (p + 4 > chunksEnd) return false;
+                px.r = data[p++]; px.g = data[p++]; px.b = data[p++]; px.a = data[p++];
+            }
+            else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+                px = index[b1];
+            }
+            else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+                px.r += ((b1 >> 4) & 0x03) - 2;
+                px.g += ((b1 >> 2) & 0x03) - 2;
+                px.b += (b1 & 0x03) - 2;
+            }
+            else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+                if (p + 1 > chunksEnd) return false;
+                int b2 = data[p++];
+                int vg = (b1 & 0x3F) - 32;
+                px.r += vg - 8 + ((b2 >> 4) & 0x0F);
+                px.g += vg;
+                px.b += vg - 8 + (b2 & 0x0F);
+            }
+            else {
+                run = b1 & 0x3F;
+            }
+            index[QoiHash(px)] = px;
+        }
+        row[x * 4 + 0] = px.r;
+        row[x * 4 + 1] = px.g;
+        row[x * 4 + 2] = px.b;
+        row[x * 4 + 3] = px.a;
+        x++;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// PPM (P6), PAM (P7) and PFM
+//-----------------------------------------------------------------------------
+
+// Read the next whitespace separated token of a PNM header, skipping '#' comments
+static bool NextPnmToken(const unsigned char* data, size_t size, size_t& p, std::string& token)
+{
+    token.clear();
+    while (p < size) {
+        if (data[p] == '#') {
+            while (p < size && data[p] != '\n')
+                p++;
+        }
+        else if (isspace(data[p])) {
+            p++;
+        }
+        else {
+            break;
+        }
+    }
+    while (p < size && !isspace(data[p]))
+        token += (char)data[p++];
+    return !token.empty();
+}
+
+static bool ParsePnmInt(const std::string& token, int& value)
+{
+    char* end = nullptr;
+    long v = strtol(token.c_str(), &end, 10);
+    if (token.empty() || *end != '\0' || v <= 0 || v > 0x3FFFFFFF)
+        return false;
+    value = (int)v;
+    return true;
+}
+
+static unsigned char ScaleSample(unsigned int v, unsigned int maxval)
+{
+    return (unsigned char)((v * 255 + maxval / 2) / maxval);
+}
+
+// Convert one row of P6/P7 samples to RGBA8
+static void ConvertPnmRow(const unsigned char* src, int width, int depth, int maxval, unsigned char* dst)
+{
+    if (depth == 4 && maxval == 255) {
+        memcpy(dst, src, (size_t)width * 4);
+        return;
+    }
+    int sampleBytes = maxval > 255 ? 2 : 1;
+    for (int x = 0; x < width; x++) {
+        unsigned char s[4];
+        for (int c = 0; c < depth; c++) {
+            unsigned int v = sampleBytes == 2 ? (src[0] << 8 | src[1]) : src[0];
+            src += sampleBytes;
+            s[c] = maxval == 255 ? (unsigned char)v : ScaleSample(v, maxval);
+        }
+        switch (depth) {
+        case 1: dst[0] = dst[1] = dst[2] = s[0]; dst[3] = 255; break;
+        case 2: dst[0] = dst[1] = dst[2] = s[0]; dst[3] = s[1]; break;
+        case 3: dst[0] = s[0]; dst[1] = s[1]; dst[2] = s[2]; dst[3] = 255; break;
+        default: dst[0] = s[0]; dst[1] = s[1]; dst[2] = s[2]; dst[3] = s[3]; break;
+        }
+        dst += 4;
+    }
+}
+
+static size_t PnmRowBytes(int width, int depth, int maxval)
+{
+    return (size_t)width * depth * (maxval > 255 ? 2 : 1);
+}
+
+// P6 and P7 share the sample layout once the header is parsed
+static bool DecodePnmSamples(const unsigned char* data, size_t size, size_t p, int width, int height, int depth, int maxval,
+                             ImageData& out, std::shared_ptr<void> owner)
+{
+    size_t rowBytes = PnmRowBytes(width, depth, maxval);
+    if (size < p || (size - p) / rowBytes < (size_t)height)
+        return false;
+    const unsigned char* src = data + p;
+
+    if (depth == 4 && maxval == 255) {
+        // Already RGBA8: point straight into the file image
+        out.width = width;
+        out.height = height;
+        out.stride = width * 4;
+        out.pixels = src;
+        out.owner = owner;
+        return true;
+    }
+
+    unsigned char* dst = AllocateImage(out, width, height);
+    if (!dst)
+        return false;
+    for (int y = 0; y < height; y++)
+        ConvertPnmRow(src + rowBytes * y, width, depth, maxval, dst + (size_t)y * out.stride);
+    return true;
+}
+
+// Parse a P6 or P7 header. On success 'p' is the offset of the first sample.
+static bool ParsePnmHeader(const unsigned char* data, size_t size, size_t& p, int& width, int& height, int& depth, int& maxval)
+{
+    if (size < 3 || data[0] != 'P' || (data[1] != '6' && data[1] != '7'))
+        return false;
+    p = 2;
+    std::string token;
+    if (data[1] == '6') {
+        depth = 3;
+        if (!NextPnmToken(data, size, p, token) || !ParsePnmInt(token, width)) return false;
+        if (!NextPnmToken(data, size, p, token) || !ParsePnmInt(token, height)) return false;
+        if (!NextPnmToken(data, size, p, token) || !ParsePnmInt(token, maxval) || maxval > 65535) return false;
+        p++;    // Single whitespace before the raster
+        return p <= size;
+    }
+
+    width = height = depth = maxval = 0;
+    while (NextPnmToken(data, size, p, token)) {
+        if (token == "ENDHDR")
+            break;
+        std::string value;
+        if (token == "TUPLTYPE") {
+            while (p < size && data[p] != '\n')    // Free-form, we go by DEPTH
+                p++;
+            continue;
+        }
+        if (!NextPnmToken(data, size, p, value))
+            return false;
+        if (token == "WIDTH" && !ParsePnmInt(value, width)) return false;
+        if (token == "HEIGHT" && !ParsePnmInt(value, height)) return false;
+        if (token == "DEPTH" && !ParsePnmInt(value, depth)) return false;
+        if (token == "MAXVAL" && !ParsePnmInt(value, maxval)) return false;
+    }
+    if (token != "ENDHDR" || width == 0 || height == 0 || depth < 1 || depth > 4 || maxval == 0 || maxval > 65535)
+        return false;
+    p++;    // Newline after ENDHDR
+    return p <= size;
+}
+
+static bool DecodePnm(const unsigned char* data, size_t size, ImageData& out, std::shared_ptr<void> owner)
+{
+    size_t p;
+    int width, height, depth, maxval;
+    if (!ParsePnmHeader(data, size, p, width, height, depth, maxval))
+        return false;
+    return DecodePnmSamples(data, size, p, width, height, depth, maxval, out, owner);
+}
+
+static bool DecodePFM(const unsigned char* data, size_t size, ImageData& out)
+{
+    int channels = data[1] == 'F' ? 3 : 1;
+    size_t p = 2;
+    std::string token;
+    int width, height;
+    if (!NextPnmToken(data, size, p, token) || !ParsePnmInt(token, width)) return false;
+    if (!NextPnmToken(data, size, p, token) || !ParsePnmInt(token, height)) return false;
+    if (!NextPnmToken(data, size, p, token)) return false;
+    bool littleEndian = atof(token.c_str()) < 0.0;
+    p++;
+
+    size_t rowBytes = (size_t)width * channels * 4;
+    if (size < p || (size - p) / rowBytes < (size_t)height)
+        return false;
+
+    unsigned char* dst = AllocateImage(out, width, height);
+    if (!dst)
+        return false;
+    for (int y = 0; y < height; y++) {
+        // PFM rows are stored bottom to top
+        const unsigned char* src = data + p + rowBytes * (height - 1 - y);
+        unsigned char* row = dst + (size_t)y * out.stride;
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < 3; c++) {
+                const unsigned char* s = src + ((size_t)x * channels + (channels == 3 ? c : 0)) * 4;
+                unsigned int bits = littleEndian ? GetU32LE(s) : GetU32BE(s);
+                float v;
+                memcpy(&v, &bits, 4);
+                v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+                row[x * 4 + c] = (unsigned char)(v * 255.0f + 0.5f);
+            }
+            row[x * 4 + 3] = 255;
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Native raw dump
+//-----------------------------------------------------------------------------
+
+// 64-byte little-endian header, so the rows of a mapped file stay 64-byte aligned:
+//   "NRAW", version, width, height, stride, pixel format (0 = RGBA8), data offset, zero padding
+static const unsigned char RawMagic[4] = { 'N', 'R', 'A', 'W' };
+static const unsigned int RawVersion = 1;
+static const unsigned int RawHeaderSize = 64;
+
+// Check a raw header and return the layout of the rows
+static bool ParseRawHeader(const unsigned char* data, size_t size, int& width, int& height, unsigned int& stride, unsigned int& offset)
+{
+    if (size < RawHeaderSize || memcmp(data, RawMagic, 4) != 0 || GetU32LE(data + 4) != RawVersion)
+        return false;
+    unsigned int w = GetU32LE(data + 8);
+    unsigned int h = GetU32LE(data + 12);
+    unsigned int pixelFormat = GetU32LE(data + 20);
+    stride = GetU32LE(data + 16);
+    offset = GetU32LE(data + 24);
+    if (pixelFormat != 0 || w == 0 || h == 0 || w > 0x7FFFFFFF / 4 || h > 0x7FFFFFFF || stride < w * 4 || offset < RawHeaderSize)
+        return false;
+    width = (int)w;
+    height = (int)h;
+    return true;
+}
+
+static bool DecodeRaw(const unsigned char* data, size_t size, ImageData& out, std::shared_ptr<void> owner)
+{
+    int width, height;
+    unsigned int stride, offset;
+    if (!ParseRawHeader(data, size, width, height, stride, offset))
+        return false;
+    if (size < offset || (size - offset) / stride < (size_t)height)
+        return false;
+
+    out.width = width;
+    out.height = height;
+    out.stride = (int)stride;
+    out.pixels = data + offset;
+    out.owner = owner;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Uncompressed writers (PPM, PAM, PFM, raw)
+//-----------------------------------------------------------------------------
+
+static bool IsRasterFormat(ImageFileFormat format)
+{
+    return format == ImageFileFormat_PPM || format == ImageFileFormat_PAM || format == ImageFileFormat_PFM || format == ImageFileFormat_Raw;
+}
+
+static void WriteRasterHeader(std::vector<unsigned char>& out, ImageFileFormat format, int width, int height)
+{
+    char header[128];
+    int headerLen = 0;
+    switch (format) {
+    case ImageFileFormat_PPM:
+        headerLen = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+        break;
+    case ImageFileFormat_PAM:
+        headerLen = snprintf(header, sizeof(header), "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", width, height);
+        break;
+    case ImageFileFormat_PFM:
+        headerLen = snprintf(header, sizeof(header), "PF\n%d %d\n-1.0\n", width, height);
+        break;
+    default: {
+        size_t start = out.size();
+        out.insert(out.end(), RawMagic, RawMagic + 4);
+        PutU32LE(out, RawVersion);
+        PutU32LE(out, (unsigned int)width);
+        PutU32LE(out, (unsigned int)height);
+        PutU32LE(out, (unsigned int)width * 4);
+        PutU32LE(out, 0);
+        PutU32LE(out, RawHeaderSize);
+        out.resize(start + RawHeaderSize, 0);
+        return;
+    }
+    }
+    out.insert(out.end(), header, header + headerLen);
+}
+
+static size_t RasterRowBytes(ImageFileFormat format, int width)
+{
+    switch (format) {
+    case ImageFileFormat_PPM: return (size_t)width * 3;
+    case ImageFileFormat_PFM: return (size_t)width * 3 * sizeof(float);
+    default: return (size_t)width * 4;
+    }
+}
+
+// Convert one RGBA8 row to the file's sample layout
+static void ConvertRasterRow(ImageFileFormat format, const unsigned char* src, int width, unsigned char* dst)
+{
+    if (format == ImageFileFormat_PPM) {
+        for (int x = 0; x < width; x++, src += 4, dst += 3) {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+        }
+    }
+    else if (format == ImageFileFormat_PFM) {
+        for (int x = 0; x < width * 4; x++) {
+            if ((x & 3) == 3)
+                continue;
+            float v = src[x] * (1.0f / 255.0f);
+            unsigned int bits;
+            memcpy(&bits, &v, 4);
+            dst[0] = (unsigned char)bits;
+            dst[1] = (unsigned char)(bits >> 8);
+            dst[2] = (unsigned char)(bits >> 16);
+            dst[3] = (unsigned char)(bits >> 24);
+            dst += 4;
+        }
+    }
+    else {
+        memcpy(dst, src, (size_t)width * 4);
+    }
+}
+
+static void EncodeRaster(std::vector<unsigned char>& out, ImageFileFormat format, const unsigned char* rgba, int width, int height, int stride)
+{
+    out.clear();
+    WriteRasterHeader(out, format, width, height);
+    size_t headerLen = out.size();
+    size_t rowBytes = RasterRowBytes(format, width);
+    out.resize(headerLen + rowBytes * height);
+    for (int y = 0; y < height; y++) {
+        // PFM rows are stored bottom to top
+        int srcY = format == ImageFileFormat_PFM ? height - 1 - y : y;
+        ConvertRasterRow(format, rgba + (size_t)srcY * stride, width, out.data() + headerLen + rowBytes * y);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// File mapping
+//-----------------------------------------------------------------------------
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    fileHandle = file;
+    mappingHandle = mapping;
+    data = (const unsigned char*)view;
+    size = (size_t)fileSize.QuadPart;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // The mapping keeps its own reference
+    if (view == MAP_FAILED)
+        return false;
+    data = (const unsigned char*)view;
+    size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (!data)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(mappingHandle);
+    CloseHandle(fileHandle);
+    mappingHandle = fileHandle = nullptr;
+#else
+    munmap((void*)data, size);
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Format dispatch
+//-----------------------------------------------------------------------------
+
+ImageFileFormat ImageFormatFromPath(const std::string& path)
+{
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos)
+        return ImageFileFormat_Other;
+    std::string ext = path.substr(dot + 1);
+    for (char& c : ext)
+        c = (char)tolower((unsigned char)c);
+    if (ext == "png") return ImageFileFormat_PNG;
+    if (ext == "qoi") return ImageFileFormat_QOI;
+    if (ext == "ppm" || ext == "pnm") return ImageFileFormat_PPM;
+    if (ext == "pam") return ImageFileFormat_PAM;
+    if (ext == "pfm") return ImageFileFormat_PFM;
+    if (ext == "raw") return ImageFileFormat_Raw;
+    return ImageFileFormat_Other;
+}
+
+const char* ImageFormatName(ImageFileFormat format)
+{
+    switch (format) {
+    case ImageFileFormat_PNG: return "PNG";
+    case ImageFileFormat_QOI: return "QOI";
+    case ImageFileFormat_PPM: return "PPM";
+    case ImageFileFormat_PAM: return "PAM";
+    case ImageFileFormat_PFM: return "PFM";
+    case ImageFileFormat_Raw: return "Raw";
+    default: return "Other";
+    }
+}
+
+// Identify a file image by its magic bytes
+static ImageFileFormat SniffImageFormat(const unsigned char* data, size_t size)
+{
+    if (size >= 4 && memcmp(data, "qoif", 4) == 0) return ImageFileFormat_QOI;
+    if (size >= 4 && memcmp(data, RawMagic, 4) == 0) return ImageFileFormat_Raw;
+    if (size >= 8 && data[0] == 0x89 && data[1] == 'P' && data[2] == 'N' && data[3] == 'G') return ImageFileFormat_PNG;
+    if (size >= 3 && data[0] == 'P' && isspace(data[2])) {
+        if (data[1] == '6') return ImageFileFormat_PPM;
+        if (data[1] == '7') return ImageFileFormat_PAM;
+        if (data[1] == 'F' || data[1] == 'f') return ImageFileFormat_PFM;
+    }
+    return ImageFileFormat_Other;
+}
+
+// stb_image reader over a memory block which reports how far the decoder has read
+struct ProgressReader {
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+    std::atomic<float>* progress;
+
+    static int Read(void* user, char* dst, int count) {
+        ProgressReader* r = (ProgressReader*)user;
+        size_t n = std::min((size_t)count, r->size - r->pos);
+        memcpy(dst, r->data + r->pos, n);
+        r->pos += n;
+        r->progress->store((float)r->pos / r->size, std::memory_order_relaxed);
+        return (int)n;
+    }
+    static void Skip(void* user, int n) {
+        ProgressReader* r = (ProgressReader*)user;
+        if (n < 0 && (size_t)-n > r->pos)
+            r->pos = 0;
+        else
+            r->pos = std::min(r->size, r->pos + n);
+    }
+    static int Eof(void* user) {
+        ProgressReader* r = (ProgressReader*)user;
+        return r->pos >= r->size;
+    }
+};
+
+bool DecodeImage(const unsigned char* data, size_t size, ImageFileFormat format, ImageData& out, std::shared_ptr<void> owner,
+                 std::atomic<float>* progress)
+{
+    if (!data || size == 0)
+        return false;
+    switch (format) {
+    case ImageFileFormat_QOI: return DecodeQOI(data, size, out, progress);
+    case ImageFileFormat_PPM:
+    case ImageFileFormat_PAM: return DecodePnm(data, size, out, owner);
+    case ImageFileFormat_PFM: return DecodePFM(data, size, out);
+    case ImageFileFormat_Raw: return DecodeRaw(data, size, out, owner);
+    default: break;
+    }
+
+    if (size > 0x7FFFFFFF)
+        return false;   // stb_image takes an int length
+    int width = 0, height = 0, channels = 0;
+    unsigned char* pixels = nullptr;
+    if (progress) {
+        static const stbi_io_callbacks callbacks = { ProgressReader::Read, ProgressReader::Skip, ProgressReader::Eof };
+        ProgressReader reader = { data, size, 0, progress };
+        pixels = stbi_load_from_callbacks(&callbacks, &reader, &width, &height, &channels, 4);
+    }
+    else {
+        pixels = stbi_load_from_memory(data, (int)size, &width, &height, &channels, 4);
+    }
+    if (!pixels)
+        return false;
+    out.width = width;
+    out.height = height;
+    out.stride = width * 4;
+    out.pixels = pixels;
+    out.owner = std::shared_ptr<void>(pixels, stbi_image_free);
+    return true;
+}
+
+bool ReadImageFile(const std::string& path, ImageData& out, std::atomic<float>* progress)
+{
+    // Map rather than read: raw and RGBA PAM files are then used in place, and the
+    // other decoders work straight from the page cache without an extra copy
+    auto file = std::make_shared<MappedFile>();
+    if (!file->Open(path))
+        return false;
+    ImageFileFormat format = SniffImageFormat(file->Data(), file->Size());
+    bool ok = DecodeImage(file->Data(), file->Size(), format, out, file, progress);
+    if (progress)
+        progress->store(1.0f, std::memory_order_relaxed);
+    return ok;
+}
+
+bool EncodeImage(std::vector<unsigned char>& out, ImageFileFormat format, const unsigned char* rgba, int width, int height, int stride,
+                 PngCompression level, int numThreads)
+{
+    if (!rgba || width <= 0 || height <= 0)
+        return false;
+    switch (format) {
+    case ImageFileFormat_PNG: return EncodePNG(out, rgba, width, height, stride, level, numThreads);
+    case ImageFileFormat_QOI: return EncodeQOI(out, rgba, width, height, stride);
+    case ImageFileFormat_PPM:
+    case ImageFileFormat_PAM:
+    case ImageFileFormat_PFM:
+    case ImageFileFormat_Raw: EncodeRaster(out, format, rgba, width, height, stride); return true;
+    default: return false;
+    }
+}
+
+bool EncodeImage(std::vector<unsigned char>& out, ImageFileFormat format, const ImageData& image, PngCompression level, int numThreads)
+{
+    if (image.format != PixelFormat_RGBA8)
+        return false;
+    return EncodeImage(out, format, image.pixels, image.width, image.height, image.stride, level, numThreads);
+}
+
+bool WriteImageFile(const std::string& path, ImageFileFormat format, const unsigned char* rgba, int width, int height, int stride,
+                    PngCompression level, int numThreads)
+{
+    std::vector<unsigned char> encoded;
+    if (!EncodeImage(encoded, format, rgba, width, height, stride, level, numThreads))
+        return false;
+    return WriteFileBytes(path, encoded);
+}
+
+bool WriteImageFile(const std::string& path, ImageFileFormat format, const ImageData& image, PngCompression level, int numThreads)
+{
+    if (image.format != PixelFormat_RGBA8)
+        return false;
+    return WriteImageFile(path, format, image.pixels, image.width, image.height, image.stride, level, numThreads);
+}
+
+bool CopyToImageBuffer(const ImageData& image, ImageBuffer& out)
+{
+    if (!image.pixels || !out.Allocate(image.width, image.height, image.format))
+        return false;
+    size_t rowBytes = out.RowBytes();
+    for (int y = 0; y < image.height; y++)
+        memcpy(out.Row(y), image.pixels + (size_t)y * image.stride, rowBytes);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Inflate (RFC 1951), incremental
+//-----------------------------------------------------------------------------
+
+// Canonical Huffman decoder: codes up to FastBits long resolve with one table lookup,
+// longer ones are walked a bit at a time through the per-length counts
+struct HuffmanDecoder {
+    static const int FastBits = 10;
+    unsigned short fast[1 << FastBits];     // (length << 9) | symbol, 0 for codes longer than FastBits
+    unsigned short count[16];
+    unsigned short symbols[288];
+
+    bool Build(const unsigned char* lengths, int n) {
+        memset(count, 0, sizeof(count));
+        memset(fast, 0, sizeof(fast));
+        for (int i = 0; i < n; i++)
+            count[lengths[i]]++;
+        count[0] = 0;
+        int left = 1;
+        for (int len = 1; len < 16; len++) {
+            left = (left << 1) - count[len];
+            if (left < 0)
+                return false;   // Over-subscribed
+        }
+        unsigned short offsets[16] = {};
+        for (int len = 1; len < 15; len++)
+            offsets[len + 1] = (unsigned short)(offsets[len] + count[len]);
+        for (int i = 0; i < n; i++)
+            if (lengths[i])
+                symbols[offsets[lengths[i]]++] = (unsigned short)i;
+
+        unsigned int code = 0;
+        int index = 0;
+        for (int len = 1; len <= FastBits; len++) {
+            for (int k = 0; k < count[len]; k++, code++, index++) {
+                for (unsigned int f = ReverseBits(code, len); f < (1u << FastBits); f += 1u << len)
+                    fast[f] = (unsigned short)(len << 9 | symbols[index]);
+            }
+            code <<= 1;
+        }
+        return true;
+    }
+};
+
+// Pulls compressed bytes through a callback and produces exactly as much output as asked for,
+// so only the 32 KB window and the caller's buffer are ever resident
+class Inflater {
+public:
+    // Fill up to 'count' bytes of compressed input, return how many (0 at the end of the input)
+    typedef size_t (*ReadFn)(void* user, unsigned char* dst, size_t count);
+
+    Inflater(ReadFn read, void* user) : readFn(read), readUser(user) {}
+
+    // Decompress the next 'count' bytes; false if the stream is corrupt or ends early
+    bool Read(unsigned char* dst, size_t count);
+
+private:
+    enum State { State_BlockHeader, State_Stored, State_Huffman, State_Done };
+    static const size_t WindowSize = 32768;
+
+    unsigned char NextByte() {
+        if (inPos == inLen) {
+            inPos = 0;
+            inLen = readFn(readUser, inBuf, sizeof(inBuf));
+            if (inLen == 0) {
+                overrun++;  // Feed zeros; lookahead may legitimately run past the end
+                return 0;
+            }
+        }
+        return inBuf[inPos++];
+    }
+    void NeedBits(int n) {
+        while (bitCount < n) {
+            bitBuffer |= (unsigned long long)NextByte() << bitCount;
+            bitCount += 8;
+        }
+    }
+    unsigned int GetBits(int n) {
+        NeedBits(n);
+        unsigned int v = (unsigned int)(bitBuffer & ((1ull << n) - 1));
+        bitBuffer >>= n;
+        bitCount -= n;
+        return v;
+    }
+    void Emit(unsigned char b, unsigned char* dst) {
+        window[totalOut++ & (WindowSize - 1)] = b;
+        *dst = b;
+    }
+    int DecodeSymbol(const HuffmanDecoder& h);
+    bool StartBlock();
+    bool ReadDynamicTables();
+
+    ReadFn readFn;
+    void* readUser;
+    unsigned char inBuf[65536];
+    size_t inPos = 0, inLen = 0;
+    int overrun = 0;
+    unsigned long long bitBuffer = 0;
+    int bitCount = 0;
+
+    State state = State_BlockHeader;
+    bool finalBlock = false;
+    size_t storedRemaining = 0;
+    int matchLength = 0;
+    int matchDistance = 0;
+    HuffmanDecoder lit, dist;
+    unsigned char window[WindowSize];
+    unsigned long long totalOut = 0;
+};
+
+int Inflater::DecodeSymbol(const HuffmanDecoder& h)
+{
+    NeedBits(15);
+    unsigned int entry = h.fast[bitBuffer & ((1u << HuffmanDecoder::FastBits) - 1)];
+    if (entry) {
+        int len = entry >> 9;
+        bitBuffer >>= len;
+        bitCount -= len;
+        return entry & 511;
+    }
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; len++) {
+        code |= (int)((bitBuffer >> (len - 1)) & 1);
+        int count = h.count[len];
+        if (code - first < count) {
+            bitBuffer >>= len;
+            bitCount -= len;
+            return h.symbols[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+bool Inflater::ReadDynamicTables()
+{
+    static const unsigned char Order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    int numLit = (int)GetBits(5) + 257;
+    int numDist = (int)GetBits(5) + 1;
+    int numCodeLen = (int)GetBits(4) + 4;
+    if (numLit > 286 || numDist > 30)
+        return false;
+
+    unsigned char lengths[286 + 30] = {};
+    for (int i = 0; i < numCodeLen; i++)
+        lengths[Order[i]] = (unsigned char)GetBits(3);
+    HuffmanDecoder codeLengths;
+    if (!codeLengths.Build(lengths, 19))
+        return false;
+
+    memset(lengths, 0, sizeof(lengths));
+    int n = 0;
+    while (n < numLit + numDist) {
+        int sym = DecodeSymbol(codeLengths);
+        if (sym < 0)
+            return false;
+        if (sym < 16) {
+            lengths[n++] = (unsigned char)sym;
+            continue;
+        }
+        unsigned char value = 0;
+        int repeat;
+        if (sym == 16) {
+            if (n == 0)
+                return false;
+            value = lengths[n - 1];
+            repeat = 3 + (int)GetBits(2);
+        }
+        else if (sym == 17) {
+            repeat = 3 + (int)GetBits(3);
+        }
+        else {
+            repeat = 11 + (int)GetBits(7);
+        }
+        if (n + repeat > numLit + numDist)
+            return false;
+        while (repeat--)
+            lengths[n++] = value;
+    }
+    if (lengths[256] == 0)
+        return false;   // No end-of-block code
+    return lit.Build(lengths, numLit) && dist.Build(lengths + numLit, numDist);
+}
+
+bool Inflater::StartBlock()
+{
+    finalBlock = GetBits(1) != 0;
+    switch (GetBits(2)) {
+    case 0: {
+        GetBits(bitCount & 7);  // Stored blocks start on a byte boundary
+        unsigned int len = GetBits(16);
+        unsigned int nlen = GetBits(16);
+        if ((len ^ 0xFFFF) != nlen)
+            return false;
+        storedRemaining = len;
+        state = State_Stored;
+        return true;
+    }
+    case 1: {
+        unsigned char lengths[288 + 30];
+        memset(lengths, 8, 144);
+        memset(lengths + 144, 9, 112);
+        memset(lengths + 256, 7, 24);
+        memset(lengths + 280, 8, 8);
+        memset(lengths + 288, 5, 30);
+        lit.Build(lengths, 288);
+        dist.Build(lengths + 288, 30);
+        state = State_Huffman;
+        return true;
+    }
+    case 2:
+        if (!ReadDynamicTables())
+            return false;
+        state = State_Huffman;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Inflater::Read(unsigned char* dst, size_t count)
+{
+    size_t produced = 0;
+    while (produced < count) {
+        if (overrun > 8)
+            return false;   // Truncated input
+        if (matchLength > 0) {
+            int n = (int)std::min((size_t)matchLength, count - produced);
+            for (int i = 0; i < n; i++)
+                Emit(window[(totalOut - matchDistance) & (WindowSize - 1)], &dst[produced++]);
+            matchLength -= n;
+            continue;
+        }
+
+        switch (state) {
+        case State_BlockHeader:
+            if (!StartBlock())
+                return false;
+            break;
+        case State_Stored: {
+            if (storedRemaining == 0) {
+                state = finalBlock ? State_Done : State_BlockHeader;
+                break;
+            }
+            size_t n = std::min(storedRemaining, count - produced);
+            for (size_t i = 0; i < n; i++) {
+                unsigned char b;
+                if (bitCount >= 8) {
+                    b = (unsigned char)bitBuffer;
+                    bitBuffer >>= 8;
+                    bitCount -= 8;
+                }
+                else {
+                    b = NextByte();
+                }
+                Emit(b, &dst[produced++]);
+            }
+            storedRemaining -= n;
+            break;
+        }
+        case State_Huffman:
+            while (produced < count && matchLength == 0 && state == State_Huffman) {
+                int sym = DecodeSymbol(lit);
+                if (sym < 0)
+                    return false;
+                if (sym < 256) {
+                    Emit((unsigned char)sym, &dst[produced++]);
+                }
+                else if (sym == 256) {
+                    state = finalBlock ? State_Done : State_BlockHeader;
+                }
+                else {
+                    sym -= 257;
+                    if (sym >= 29)
+                        return false;
+                    int length = LengthBase[sym] + (int)GetBits(LengthExtra[sym]);
+                    int d = DecodeSymbol(dist);
+                    if (d < 0 || d >= 30)
+                        return false;
+                    int distance = DistBase[d] + (int)GetBits(DistExtra[d]);
+                    if ((unsigned long long)distance > totalOut)
+                        return false;
+                    matchLength = length;
+                    matchDistance = distance;
+                }
+            }
+            break;
+        case State_Done:
+            return false;   // Asked for more than the stream holds
+        }
+    }
+    return overrun <= 8;
+}
+
+//-----------------------------------------------------------------------------
+// Strip readers
+//-----------------------------------------------------------------------------
+
+static bool SeekFile(FILE* f, long long offset)
+{
+#ifdef _WIN32
+    return _fseeki64(f, offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// Length of the file in bytes, or -1 if it can't be told. The position is left where it was.
+static long long FileLength(FILE* f)
+{
+#ifdef _WIN32
+    long long pos = _ftelli64(f);
+    if (pos < 0 || _fseeki64(f, 0, SEEK_END) != 0)
+        return -1;
+    long long length = _ftelli64(f);
+#else
+    long long pos = (long long)ftello(f);
+    if (pos < 0 || fseeko(f, 0, SEEK_END) != 0)
+        return -1;
+    long long length = (long long)ftello(f);
+#endif
+    return SeekFile(f, pos) ? length : -1;
+}
+
+// Base for readers over a FILE*, which they own
+class FileStripReader : public ImageStripReader {
+public:
+    ~FileStripReader() override {
+        if (file)
+            fclose(file);
+    }
+
+protected:
+    explicit FileStripReader(FILE* f) : file(f) {}
+    bool ReadExact(void* dst, size_t count) { return fread(dst, 1, count, file) == count; }
+
+    FILE* file;
+    int rowsRead = 0;
+};
+
+// PNG, non-interlaced, any bit depth and color type
+class PngStripReader : public FileStripReader {
+public:
+    explicit PngStripReader(FILE* f) : FileStripReader(f) {}
+    bool Open();
+    bool ReadRows(unsigned char* dst, int dstStride, int rowCount) override;
+
+private:
+    static size_t ReadIdat(void* user, unsigned char* dst, size_t count);
+    bool NextChunk(unsigned int& length, char type[5]);
+    void ConvertRow(const unsigned char* src, unsigned char* dst) const;
+    int Sample(const unsigned char* src, int index) const;
+
+    int colorType = 0;
+    int bitDepth = 0;
+    int channels = 0;
+    int bpp = 0;                            // Bytes per pixel for filtering, at least 1
+    size_t rowBytes = 0;
+    unsigned int idatRemaining = 0;
+    bool idatDone = false;
+    unsigned char palette[256][4];
+    bool hasColorKey = false;
+    int colorKey[3] = {};
+    std::vector<unsigned char> curRow, prevRow;  // Filter type byte + samples
+    std::unique_ptr<Inflater> inflater;
+};
+
+bool PngStripReader::NextChunk(unsigned int& length, char type[5])
+{
+    unsigned char header[8];
+    if (!ReadExact(header, 8))
+        return false;
+    length = GetU32BE(header);
+    memcpy(type, header + 4, 4);
+    type[4] = '\0';
+    return length <= 0x7FFFFFFF;
+}
+
+size_t PngStripReader::ReadIdat(void* user, unsigned char* dst, size_t count)
+{
+    PngStripReader* r = (PngStripReader*)user;
+    while (r->idatRemaining == 0) {
+        if (r->idatDone)
+            return 0;
+        // Skip the CRC, then continue into the next chunk if it is another IDAT
+        unsigned char crc[4];
+        unsigned int length;
+        char type[5];
+        if (!r->ReadExact(crc, 4) || !r->NextChunk(length, type) || strcmp(type, "IDAT") != 0) {
+            r->idatDone = true;
+            return 0;
+        }
+        r->idatRemaining = length;
+    }
+    size_t n = fread(dst, 1, std::min(count, (size_t)r->idatRemaining), r->file);
+    r->idatRemaining -= (unsigned int)n;
+    if (n == 0)
+        r->idatDone = true;
+    return n;
+}
+
+bool PngStripReader::Open()
+{
+    unsigned char signature[8];
+    if (!ReadExact(signature, 8) || memcmp(signature, PngSignature, 8) != 0)
+        return false;
+
+    for (int i = 0; i < 256; i++) {
+        palette[i][0] = palette[i][1] = palette[i][2] = 0;
+        palette[i][3] = 255;
+    }
+    // Chunk lengths are checked against the file before anything is read or allocated for them.
+    // Only the header, palette and transparency chunks are read, and none of them is longer than
+    // a full palette; every other chunk before the image data is skipped.
+    const unsigned int MaxReadChunkLength = 256 * 3;
+    long long fileLength = FileLength(file);
+    long long chunkOffset = 8;
+    bool haveHeader = false;
+    for (;;) {
+        unsigned int length;
+        char type[5];
+        if (!NextChunk(length, type) || fileLength < chunkOffset + 12 || length > fileLength - chunkOffset - 12)
+            return false;
+        if (strcmp(type, "IDAT") == 0) {
+            idatRemaining = length;
+            break;
+        }
+        if (strcmp(type, "IEND") == 0)
+            return false;
+        long long nextOffset = chunkOffset + 12 + length;
+        if (strcmp(type, "IHDR") != 0 && strcmp(type, "PLTE") != 0 && strcmp(type, "tRNS") != 0) {
+            if (!SeekFile(file, nextOffset))
+                return false;
+            chunkOffset = nextOffset;
+            continue;
+        }
+        if (length > MaxReadChunkLength)
+            return false;
+
+        std::vector<unsigned char> data(length);
+        unsigned char crc[4];
+        if (!ReadExact(data.data(), length) || !ReadExact(crc, 4))
+            return false;
+        chunkOffset = nextOffset;
+        if (strcmp(type, "IHDR") == 0 && length == 13) {
+            unsigned int w = GetU32BE(&data[0]);
+            unsigned int h = GetU32BE(&data[4]);
+            bitDepth = data[8];
+            colorType = data[9];
+            if (w == 0 || h == 0 || w > 0x7FFFFFFF / 8 || h > 0x7FFFFFFF || data[12] != 0)
+                return false;   // Interlaced images can't be read in strips
+            width = (int)w;
+            height = (int)h;
+            haveHeader = true;
+        }
+        else if (strcmp(type, "PLTE") == 0) {
+            for (unsigned int i = 0; i < length / 3 && i < 256; i++) {
+                palette[i][0] = data[i * 3 + 0];
+                palette[i][1] = data[i * 3 + 1];
+                palette[i][2] = data[i * 3 + 2];
+            }
+        }
+        else if (strcmp(type, "tRNS") == 0) {
+            if (colorType == 3) {
+                for (unsigned int i = 0; i < length && i < 256; i++)
+                    palette[i][3] = data[i];
+            }
+            else if ((colorType == 0 && length >= 2) || (colorType == 2 && length >= 6)) {
+                hasColorKey = true;
+                for (unsigned int i = 0; i < length / 2 && i < 3; i++)
+                    colorKey[i] = data[i * 2] << 8 | data[i * 2 + 1];
+            }
+        }
+    }
+    if (!haveHeader)
+        return false;
+
+    switch (colorType) {
+    case 0: channels = 1; break;
+    case 2: channels = 3; break;
+    case 3: channels = 1; break;
+    case 4: channels = 2; break;
+    case 6: channels = 4; break;
+    default: return false;
+    }
+    bool validDepth = bitDepth == 8 || (bitDepth == 16 && colorType != 3) ||
+                      ((bitDepth == 1 || bitDepth == 2 || bitDepth == 4) && (colorType == 0 || colorType == 3));
+    if (!validDepth)
+        return false;
+    bpp = std::max(1, channels * bitDepth / 8);
+    rowBytes = ((size_t)width * channels * bitDepth + 7) / 8;
+    // Deflate expands at most 1032:1, so rows that the rest of the file could not inflate to
+    // mean a corrupt header
+    const unsigned long long MaxDeflateRatio = 1032;
+    unsigned long long compressedMax = (unsigned long long)(fileLength - chunkOffset) * MaxDeflateRatio;
+    if ((rowBytes + 1) > compressedMax / (unsigned long long)height)
+        return false;
+    curRow.assign(rowBytes + 1, 0);
+    prevRow.assign(rowBytes + 1, 0);
+
+    // zlib header; it may straddle IDAT chunks like everything else
+    unsigned char zlibHeader[2];
+    for (int i = 0; i < 2; i++)
+        if (ReadIdat(this, &zlibHeader[i], 1) != 1)
+            return false;
+    if ((zlibHeader[0] & 0x0F) != 8 || (zlibHeader[0] << 8 | zlibHeader[1]) % 31 != 0 || (zlibHeader[1] & 0x20))
+        return false;
+    inflater.reset(new Inflater(ReadIdat, this));
+    return true;
+}
+
+static void UnfilterRow(int type, unsigned char* cur, const unsigned char* prev, size_t rowBytes, int bpp)
+{
+    switch (type) {
+    case 0:
+        break;
+    case 1:
+        for (size_t i = bpp; i < rowBytes; i++)
+            cur[i] = (unsigned char)(cur[i] + cur[i - bpp]);
+        break;
+    case 2:
+        for (size_t i = 0; i < rowBytes; i++)
+            cur[i] = (unsigned char)(cur[i] + prev[i]);
+        break;
+    case 3:
+        for (size_t i = 0; i < rowBytes; i++)
+            cur[i] = (unsigned char)(cur[i] + (((i >= (size_t)bpp ? cur[i - bpp] : 0) + prev[i]) >> 1));
+        break;
+    case 4:
+        for (size_t i = 0; i < rowBytes; i++) {
+            int a = i >= (size_t)bpp ? cur[i - bpp] : 0;
+            int c = i >= (size_t)bpp ? prev[i - bpp] : 0;
+            cur[i] = (unsigned char)(cur[i] + Paeth(a, prev[i], c));
+        }
+        break;
+    }
+}
+
+// Sample 'index' of a row at the file's bit depth
+int PngStripReader::Sample(const unsigned char* src, int index) const
+{
+    switch (bitDepth) {
+    case 16: return src[index * 2] << 8 | src[index * 2 + 1];
+    case 8: return src[index];
+    default: {
+        int bit = index * bitDepth;
+        return (src[bit >> 3] >> (8 - bitDepth - (bit & 7))) & ((1 << bitDepth) - 1);
+    }
+    }
+}
+
+void PngStripReader::ConvertRow(const unsigned char* src, unsigned char* dst) const
+{
+    if (colorType == 6 && bitDepth == 8) {
+        memcpy(dst, src, (size_t)width * 4);
+        return;
+    }
+    // Scale to 8 bits the way stb_image does: keep the high byte of 16-bit samples,
+    // replicate low bit depths
+    const int maxval = (1 << bitDepth) - 1;
+    auto to8 = [&](int v) {
+        return (unsigned char)(bitDepth == 16 ? v >> 8 : v * 255 / maxval);
+    };
+    for (int x = 0; x < width; x++, dst += 4) {
+        int s0 = Sample(src, x * channels);
+        switch (colorType) {
+        case 0:
+            dst[0] = dst[1] = dst[2] = to8(s0);
+            dst[3] = hasColorKey && s0 == colorKey[0] ? 0 : 255;
+            break;
+        case 2: {
+            int s1 = Sample(src, x * 3 + 1), s2 = Sample(src, x * 3 + 2);
+            dst[0] = to8(s0);
+            dst[1] = to8(s1);
+            dst[2] = to8(s2);
+            dst[3] = hasColorKey && s0 == colorKey[0] && s1 == colorKey[1] && s2 == colorKey[2] ? 0 : 255;
+            break;
+        }
+        case 3:
+            memcpy(dst, palette[s0], 4);
+            break;
+        case 4:
+            dst[0] = dst[1] = dst[2] = to8(s0);
+            dst[3] = to8(Sample(src, x * 2 + 1));
+            break;
+        default:
+            dst[0] = to8(s0);
+            dst[1] = to8(Sample(src, x * 4 + 1));
+            dst[2] = to8(Sample(src, x * 4 + 2));
+            dst[3] = to8(Sample(src, x * 4 + 3));
+            break;
+        }
+    }
+}
+
+bool PngStripReader::ReadRows(unsigned char* dst, int dstStride, int rowCount)
+{
+    if (rowCount < 0 || rowsRead + rowCount > height)
+        return false;
+    for (int y = 0; y < rowCount; y++) {
+        if (!inflater->Read(curRow.data(), curRow.size()) || curRow[0] > 4)
+            return false;
+        UnfilterRow(curRow[0], &curRow[1], &prevRow[1], rowBytes, bpp);
+        ConvertRow(&curRow[1], dst + (size_t)y * dstStride);
+        curRow.swap(prevRow);
+    }
+    rowsRead += rowCount;
+    return true;
+}
+
+// PPM, PAM and raw dumps: fixed-size rows read straight from the file
+class RasterStripReader : public FileStripReader {
+public:
+    explicit RasterStripReader(FILE* f) : FileStripReader(f) {}
+    bool Open(ImageFileFormat format);
+    bool ReadRows(unsigned char* dst, int dstStride, int rowCount) override;
+
+private:
+    int depth = 4;
+    int maxval = 255;
+    size_t srcStride = 0;
+    std::vector<unsigned char> row;
+};
+
+bool RasterStripReader::Open(ImageFileFormat format)
+{
+    // The header is at the start of the file and a few KB at most
+    unsigned char header[4096];
+    size_t size = fread(header, 1, sizeof(header), file);
+    long long dataOffset;
+    if (format == ImageFileFormat_Raw) {
+        unsigned int stride, offset;
+        if (!ParseRawHeader(header, size, width, height, stride, offset))
+            return false;
+        srcStride = stride;
+        dataOffset = offset;
+    }
+    else {
+        size_t p;
+        if (!ParsePnmHeader(header, size, p, width, height, depth, maxval))
+            return false;
+        srcStride = PnmRowBytes(width, depth, maxval);
+        dataOffset = (long long)p;
+    }
+    // Like the in-memory decoders: the rows the header promises must be in the file
+    long long length = FileLength(file);
+    if (length < dataOffset || (unsigned long long)(length - dataOffset) / srcStride < (unsigned long long)height)
+        return false;
+    row.resize(srcStride);
+    return SeekFile(file, dataOffset);
+}
+
+bool RasterStripReader::ReadRows(unsigned char* dst, int dstStride, int rowCount)
+{
+    if (rowCount < 0 || rowsRead + rowCount > height)
+        return false;
+    for (int y = 0; y < rowCount; y++) {
+        if (!ReadExact(row.data(), srcStride))
+            return false;
+        ConvertPnmRow(row.data(), width, depth, maxval, dst + (size_t)y * dstStride);
+    }
+    rowsRead += rowCount;
+    return true;
+}
+
+// Adapter over an image that is already in memory
+class MemoryStripReader : public ImageStripReader {
+public:
+    explicit MemoryStripReader(const ImageData& img) : image(img) {
+        width = image.width;
+        height = image.height;
+    }
+    bool ReadRows(unsigned char* dst, int dstStride, int rowCount) override {
+        if (rowCount < 0 || rowsRead + rowCount > height)
+            return false;
+        for (int y = 0; y < rowCount; y++)
+            memcpy(dst + (size_t)y * dstStride, image.pixels + (size_t)(rowsRead + y) * image.stride, (size_t)width * 4);
+        rowsRead += rowCount;
+        return true;
+    }
+
+private:
+    ImageData image;
+    int rowsRead = 0;
+};
+
+std::unique_ptr<ImageStripReader> OpenImageStripReader(const std::string& path)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f)
+        return nullptr;
+    unsigned char magic[8];
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    ImageFileFormat format = SniffImageFormat(magic, n);
+    if (!SeekFile(f, 0)) {
+        fclose(f);
+        return nullptr;
+    }
+
+    if (format == ImageFileFormat_PNG) {
+        std::unique_ptr<PngStripReader> reader(new PngStripReader(f));
+        if (reader->Open())
+            return reader;
+    }
+    else if (format == ImageFileFormat_PPM || format == ImageFileFormat_PAM || format == ImageFileFormat_Raw) {
+        std::unique_ptr<RasterStripReader> reader(new RasterStripReader(f));
+        if (reader->Open(format))
+            return reader;
+    }
+    else {
+        fclose(f);
+    }
+    return nullptr;
+}
+
+std::unique_ptr<ImageStripReader> MakeMemoryStripReader(const ImageData& image)
+{
+    if (!image.pixels || image.width <= 0 || image.height <= 0)
+        return nullptr;
+    return std::unique_ptr<ImageStripReader>(new MemoryStripReader(image));
+}
+
+bool ReadImagePreview(ImageStripReader& reader, int maxSize, ImageData& out, std::atomic<float>* progress)
+{
+    const int width = reader.Width();
+    const int height = reader.Height();
+    if (width <= 0 || height <= 0 || maxSize <= 0)
+        return false;
+    int factor = std::max((width + maxSize - 1) / maxSize, (height + maxSize - 1) / maxSize);
+    factor = std::max(factor, 1);
+    const int outWidth = (width + factor - 1) / factor;
+    const int outHeight = (height + factor - 1) / factor;
+    // The band is 'factor' full-width rows; a header that slipped past the reader's checks can
+    // still ask for more than there is, so both allocations are checked
+    unsigned char* dst = AllocateImage(out, outWidth, outHeight);
+    if (!dst)
+        return false;
+
+    // Box filter: one band of 'factor' rows in memory at a time
+    ImageBuffer band;
+    if (!band.Allocate(width, factor))
+        return false;
+    ScratchScope scope;
+    unsigned int* sums = ScratchArena::ForThread().AllocateArray<unsigned int>((size_t)outWidth * 4);
+    for (int oy = 0; oy < outHeight; oy++) {
+        int rows = std::min(factor, height - oy * factor);
+        if (!reader.ReadRows(band.Rows(0, rows)))
+            return false;
+        std::fill(sums, sums + (size_t)outWidth * 4, 0u);
+        for (int r = 0; r < rows; r++) {
+            const unsigned char* src = band.Row(r);
+            for (int ox = 0; ox < outWidth; ox++) {
+                int xEnd = std::min(width, (ox + 1) * factor);
+                unsigned int* sum = &sums[(size_t)ox * 4];
+                for (int x = ox * factor; x < xEnd; x++) {
+                    sum[0] += src[x * 4 + 0];
+                    sum[1] += src[x * 4 + 1];
+                    sum[2] += src[x * 4 + 2];
+                    sum[3] += src[x * 4 + 3];
+                }
+            }
+        }
+        unsigned char* row = dst + (size_t)oy * out.stride;
+        for (int ox = 0; ox < outWidth; ox++) {
+            unsigned int count = (unsigned int)(std::min(width, (ox + 1) * factor) - ox * factor) * rows;
+            for (int c = 0; c < 4; c++)
+                row[ox * 4 + c] = (unsigned char)((sums[(size_t)ox * 4 + c] + count / 2) / count);
+        }
+        if (progress)
+            progress->store((float)(oy + 1) / outHeight, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+bool MakeImagePreview(const ImageData& image, int maxSize, ImageData& out)
+{
+    if (image.pixels && image.width <= maxSize && image.height <= maxSize) {
+        out = image;
+        return true;
+    }
+    std::unique_ptr<ImageStripReader> reader = MakeMemoryStripReader(image);
+    return reader && ReadImagePreview(*reader, maxSize, out);
+}
+
+//-----------------------------------------------------------------------------
+// Strip writers
+//-----------------------------------------------------------------------------
+
+class FileStripWriter : public ImageStripWriter {
+public:
+    ~FileStripWriter() override {
+        if (file)
+            fclose(file);
+    }
+    bool Finish() override {
+        bool ok = file && !failed && rowsWritten == height;
+        if (file)
+            ok = (fclose(file) == 0) && ok;
+        file = nullptr;
+        return ok;
+    }
+
+protected:
+    FileStripWriter(FILE* f, int w, int h) : file(f), width(w), height(h) {}
+    bool Write(const unsigned char* data, size_t size) {
+        if (!failed && fwrite(data, 1, size, file) != size)
+            failed = true;
+        return !failed;
+    }
+    bool BeginRows(int rowCount) {
+        if (failed || !file || rowCount < 0 || rowsWritten + rowCount > height)
+            failed = true;
+        return !failed;
+    }
+
+    FILE* file;
+    int width, height;
+    int rowsWritten = 0;
+    bool failed = false;
+};
+
+// Filters and deflates each strip as it arrives, keeping the last 32 KB of filtered data
+// as the dictionary for the next one
+class PngStripWriter : public FileStripWriter {
+public:
+    PngStripWriter(FILE* f, int w, int h, PngCompression lvl, int threads)
+        : FileStripWriter(f, w, h), level(lvl), numThreads(threads) {
+        std::vector<unsigned char> header;
+        WritePngHeader(header, width, height);
+        Write(header.data(), header.size());
+        prevRow.resize((size_t)width * 4);
+    }
+
+    bool WriteRows(const unsigned char* rgba, int stride, int rowCount) override {
+        if (!BeginRows(rowCount))
+            return false;
+        const size_t WindowSize = 32768;
+        size_t keep = std::min(filtered.size(), WindowSize);
+        if (keep > 0)   // Empty before the first strip, when data() may be null
+            memmove(filtered.data(), filtered.data() + filtered.size() - keep, keep);
+        filtered.resize(keep + ((size_t)width * 4 + 1) * rowCount);
+        FilterRows(rgba, stride, width, rowCount, rowsWritten > 0 ? prevRow.data() : nullptr, level, numThreads, filtered.data() + keep);
+        if (rowCount > 0)
+            memcpy(prevRow.data(), rgba + (size_t)(rowCount - 1) * stride, prevRow.size());
+
+        rowsWritten += rowCount;
+        bool last = rowsWritten == height;
+        DeflateChunks(filtered.data(), keep, filtered.size(), last, level, numThreads, chunks);
+        for (const DeflateChunk& chunk : chunks) {
+            Write(chunk.idat.data(), chunk.idat.size());
+            adler = CombineAdler32(adler, chunk.adler, chunk.end - chunk.begin);
+        }
+        if (last) {
+            std::vector<unsigned char> trailer;
+            WritePngTrailer(trailer, adler);
+            Write(trailer.data(), trailer.size());
+        }
+        return !failed;
+    }
+
+private:
+    PngCompression level;
+    int numThreads;
+    std::vector<unsigned char> prevRow;     // Unfiltered last row of the previous strip
+    std::vector<unsigned char> filtered;    // Dictionary tail followed by the current strip
+    std::vector<DeflateChunk> chunks;
+    unsigned int adler = 1;
+};
+
+class QoiStripWriter : public FileStripWriter {
+public:
+    QoiStripWriter(FILE* f, int w, int h) : FileStripWriter(f, w, h) {
+        unsigned char header[QoiHeaderSize];
+        WriteQoiHeader(header, width, height);
+        Write(header, sizeof(header));
+    }
+
+    bool WriteRows(const unsigned char* rgba, int stride, int rowCount) override {
+        if (!BeginRows(rowCount))
+            return false;
+        encoded.resize((size_t)width * 5 + 1 + sizeof(QoiPadding));
+        for (int y = 0; y < rowCount; y++)
+            Write(encoded.data(), encoder.EncodeRow(rgba + (size_t)y * stride, width, encoded.data()));
+        rowsWritten += rowCount;
+        if (rowsWritten == height)
+            Write(encoded.data(), encoder.Finish(encoded.data()));
+        return !failed;
+    }
+
+private:
+    QoiEncoder encoder;
+    std::vector<unsigned char> encoded;
+};
+
+class RasterStripWriter : public FileStripWriter {
+public:
+    RasterStripWriter(FILE* f, int w, int h, ImageFileFormat fmt) : FileStripWriter(f, w, h), format(fmt) {
+        std::vector<unsigned char> header;
+        WriteRasterHeader(header, format, width, height);
+        headerSize = header.size();
+        Write(header.data(), header.size());
+        row.resize(RasterRowBytes(format, width));
+    }
+
+    bool WriteRows(const unsigned char* rgba, int stride, int rowCount) override {
+        if (!BeginRows(rowCount))
+            return false;
+        for (int y = 0; y < rowCount && !failed; y++) {
+            if (format == ImageFileFormat_PFM) {
+                // Rows are stored bottom to top, so seek to where this one goes
+                long long offset = (long long)headerSize + (long long)row.size() * (height - 1 - (rowsWritten + y));
+                if (!SeekFile(file, offset))
+                    failed = true;
+            }
+            ConvertRasterRow(format, rgba + (size_t)y * stride, width, row.data());
+            Write(row.data(), row.size());
+        }
+        rowsWritten += rowCount;
+        return !failed;
+    }
+
+private:
+    ImageFileFormat format;
+    size_t headerSize = 0;
+    std::vector<unsigned char> row;
+};
+
+std::unique_ptr<ImageStripWriter> OpenImageStripWriter(const std::string& path, ImageFileFormat format, int width, int height,
+                                                       PngCompression level, int numThreads)
+{
+    if (width <= 0 || height <= 0 || (format != ImageFileFormat_PNG && format != ImageFileFormat_QOI && !IsRasterFormat(format)))
+        return nullptr;
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f)
+        return nullptr;
+    if (format == ImageFileFormat_PNG)
+        return std::unique_ptr<ImageStripWriter>(new PngStripWriter(f, width, height, level, ResolveThreadCount(numThreads)));
+    if (format == ImageFileFormat_QOI)
+        return std::unique_ptr<ImageStripWriter>(new QoiStripWriter(f, width, height));
+    return std::unique_ptr<ImageStripWriter>(new RasterStripWriter(f, width, height, format));
+}
+
+//-----------------------------------------------------------------------------
+// Benchmark
+//-----------------------------------------------------------------------------
+
+void BenchmarkImageFormats(const char* label, const unsigned char* rgba, int width, int height, int stride)
+{
+    struct Candidate { ImageFileFormat format; PngCompression level; const char* name; };
+    const Candidate candidates[] = {
+        { ImageFileFormat_PNG, PngCompression_Fast, "PNG fast" },
+        { ImageFileFormat_PNG, PngCompression_Store, "PNG store" },
+        { ImageFileFormat_QOI, PngCompression_Fast, "QOI" },
+        { ImageFileFormat_PAM, PngCompression_Fast, "PAM" },
+        { ImageFileFormat_PFM, PngCompression_Fast, "PFM" },
+        { ImageFileFormat_Raw, PngCompression_Fast, "Raw" },
+    };
+    typedef std::chrono::steady_clock Clock;
+    const double rawMB = (double)width * height * 4 / (1024.0 * 1024.0);
+    const int Repeats = 3;
+
+    printf("%s: %dx%d (%.1f MB RGBA)\n", label, width, height, rawMB);
+    printf("  %-10s %12s %7s %12s %12s\n", "format", "bytes", "ratio", "enc MB/s", "dec MB/s");
+    for (const Candidate& c : candidates) {
+        std::vector<unsigned char> encoded;
+        double encodeSeconds = 1e30, decodeSeconds = 1e30;
+        bool ok = true;
+        for (int r = 0; r < Repeats && ok; r++) {
+            Clock::time_point t0 = Clock::now();
+            ok = EncodeImage(encoded, c.format, rgba, width, height, stride, c.level);
+            encodeSeconds = std::min(encodeSeconds, std::chrono::duration<double>(Clock::now() - t0).count());
+        }
+        for (int r = 0; r < Repeats && ok; r++) {
+            ImageData decoded;
+            Clock::time_point t0 = Clock::now();
+            ok = DecodeImage(encoded.data(), encoded.size(), c.format, decoded);
+            decodeSeconds = std::min(decodeSeconds, std::chrono::duration<double>(Clock::now() - t0).count());
+        }
+        if (!ok) {
+            printf("  %-10s failed\n", c.name);
+            continue;
+        }
+        printf("  %-10s %12zu %6.1f%% %12.0f %12.0f\n", c.name, encoded.size(), 100.0 * encoded.size() / (rawMB * 1024.0 * 1024.0),
+               rawMB / encodeSeconds, rawMB / decodeSeconds);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Streaming memory check
+//-----------------------------------------------------------------------------
+
+// Resident set of the process now, and the most it has been so far, in bytes
+static void ResidentMemory(size_t& current, size_t& peak)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters = {};
+    counters.cb = sizeof(counters);
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    current = counters.WorkingSetSize;
+    peak = counters.PeakWorkingSetSize;
+#else
+    current = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f) {
+        unsigned long long pages = 0, residentPages = 0;
+        if (fscanf(f, "%llu %llu", &pages, &residentPages) == 2)
+            current = (size_t)residentPages * (size_t)sysconf(_SC_PAGESIZE);
+        fclose(f);
+    }
+    struct rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    peak = (size_t)usage.ru_maxrss * 1024;     // Kilobytes on Linux
+#endif
+}
+
+// Pixel (x, y) of the synthetic image: gradients with a pattern, so the PNG filters and the
+// compressor have real work to do but the file stays a fraction of the raw size
+static void SyntheticPixel(int x, int y, unsigned char* p)
+{
+    p[0] = (unsigned char)(x >> 6);
+    p[1] = (unsigned char)(y >> 6);
+    p[2] = (unsigned char)((x ^ y) & 0xF0);
+    p[3] = 255;
+}
+
+bool CheckStreamingMemory(const std::string& path, int size)
+{
+    typedef std::chrono::steady_clock Clock;
+    const int StripRows = 64;
+    const int PreviewSize = 300;
+    // Strips in flight in the writer and reader, compressor state and the preview, with room
+    // to spare; the whole image is size * size * 4 bytes
+    const size_t AllowedGrowth = (size_t)256 << 20;
+    if (size <= 0)
+        return false;
+
+    size_t baseline, peak;
+    ResidentMemory(baseline, peak);
+    Clock::time_point start = Clock::now();
+
+    bool ok = false;
+    std::unique_ptr<ImageStripWriter> writer = OpenImageStripWriter(path, ImageFileFormat_PNG, size, size, PngCompression_Fast);
+    ImageBuffer strip;
+    if (writer && strip.Allocate(size, StripRows)) {
+        ok = true;
+        for (int y = 0; y < size && ok; y += StripRows) {
+            int rows = std::min(StripRows, size - y);
+            for (int r = 0; r < rows; r++) {
+                unsigned char* row = strip.Row(r);
+                for (int x = 0; x < size; x++)
+                    SyntheticPixel(x, y + r, row + (size_t)x * 4);
+            }
+            ok = writer->WriteRows(strip.pixels, strip.stride, rows);
+        }
+        ok = writer->Finish() && ok;
+    }
+    writer.reset();
+    strip = ImageBuffer();
+    double writeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Read it back the way a streamed input node does, and spot-check the preview against a
+    // box filter of the pattern at its first pixel
+    start = Clock::now();
+    ImageData preview;
+    std::unique_ptr<ImageStripReader> reader = ok ? OpenImageStripReader(path) : nullptr;
+    ok = reader && reader->Width() == size && reader->Height() == size && ReadImagePreview(*reader, PreviewSize, preview);
+    reader.reset();
+    double readSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (ok) {
+        int factor = std::max((size + PreviewSize - 1) / PreviewSize, 1);
+        int n = std::min(factor, size);
+        unsigned int sum = 0;
+        unsigned char p[4];
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                SyntheticPixel(x, y, p);
+                sum += p[2];
+            }
+        }
+        unsigned int expected = (sum + (unsigned int)(n * n) / 2) / (unsigned int)(n * n);
+        ok = preview.width == (size + factor - 1) / factor && preview.pixels[2] == expected && preview.pixels[3] == 255;
+    }
+    remove(path.c_str());
+
+    size_t current;
+    ResidentMemory(current, peak);
+    size_t growth = peak > baseline ? peak - baseline : 0;
+    bool bounded = growth <= AllowedGrowth;
+    printf("%dx%d PNG (%.1f GB RGBA): written in %.1f s, previewed in %.1f s, peak resident set grew by %.0f MB\n", size, size,
+           (double)size * size * 4 / (1024.0 * 1024.0 * 1024.0), writeSeconds, readSeconds, growth / (1024.0 * 1024.0));
+    if (!ok)
+        printf("FAILED: the image did not round-trip through %s\n", path.c_str());
+    else if (!bounded)
+        printf("FAILED: more than %zu MB resident while streaming\n", AllowedGrowth >> 20);
+    else
+        printf("OK\n");
+    return ok && bounded;
+}
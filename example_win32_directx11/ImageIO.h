@@ -0,0 +1,177 @@
+// Image file readers and writers used by the node editor.
+//
+// PNG output is written without any external dependency: rows are filtered, then the
+// filtered data is split into independent chunks which are deflated on several threads
+// and stitched back together into one zlib stream (each chunk ends on a byte boundary).
+//
+// Images too big to decode whole are streamed instead: an ImageStripReader hands out rows
+// top to bottom a strip at a time and an ImageStripWriter encodes them as they come, so
+// memory use depends on the image width, not its size. PNG, PPM/PAM and raw dumps can be
+// read this way, and every writable format written.
+//
+// QOI, PPM/PAM/PFM and the native raw dump are fast paths for intermediate files passed
+// between pipeline stages. Raw dumps (and PAM files that are already RGBA8) are read
+// zero-copy from a memory mapping. Everything else is decoded by stb_image.
+
+#pragma once
+
+#include "ImageBuffer.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum PngCompression {
+    PngCompression_Store = 0,   // Stored deflate blocks, no filtering. Cheapest, for scratch outputs
+    PngCompression_Fast,        // Adaptive row filters + LZ77 with fixed Huffman codes
+};
+
+enum ImageFileFormat {
+    ImageFileFormat_PNG = 0,
+    ImageFileFormat_QOI,
+    ImageFileFormat_PPM,        // Binary RGB (P6), alpha is dropped
+    ImageFileFormat_PAM,        // P7 RGB_ALPHA
+    ImageFileFormat_PFM,        // 32-bit float RGB, bottom-up rows
+    ImageFileFormat_Raw,        // Native dump: 64-byte header followed by the RGBA8 rows
+    ImageFileFormat_Other,      // Anything stb_image can decode (read only)
+};
+
+// Guess the format from the file extension
+ImageFileFormat ImageFormatFromPath(const std::string& path);
+const char* ImageFormatName(ImageFileFormat format);
+
+// Read-only view of a whole file, memory-mapped
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::string& path);
+    void Close();
+    const unsigned char* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+// Read-only view of a decoded image. 'pixels' may point into a file mapping, a decoder's buffer
+// or an ImageBuffer; 'owner' keeps whichever it is alive, so copies of an ImageData share the
+// same pixels. Images decoded here are RGBA8 with aligned, padded rows, except those that are
+// zero-copy views of a mapped file or come from stb_image, which are tightly packed.
+struct ImageData {
+    int width = 0;
+    int height = 0;
+    int stride = 0;                     // Bytes between rows
+    PixelFormat format = PixelFormat_RGBA8;
+    const unsigned char* pixels = nullptr;
+    std::shared_ptr<void> owner;
+
+    ImageData() = default;
+    ImageData(const ImageBuffer& buffer)
+        : width(buffer.width), height(buffer.height), stride(buffer.stride), format(buffer.format), pixels(buffer.pixels), owner(buffer.owner) {}
+};
+
+// Writable copy of 'image' in an aligned, padded buffer
+bool CopyToImageBuffer(const ImageData& image, ImageBuffer& out);
+
+// Read any supported file as RGBA8. If given, 'progress' is updated from 0 to 1 while decoding
+// so another thread can display it.
+bool ReadImageFile(const std::string& path, ImageData& out, std::atomic<float>* progress = nullptr);
+
+// Decode an in-memory file image. Zero-copy formats point 'out' into 'data', so 'data' must
+// outlive it unless 'owner' is given.
+bool DecodeImage(const unsigned char* data, size_t size, ImageFileFormat format, ImageData& out,
+                 std::shared_ptr<void> owner = nullptr, std::atomic<float>* progress = nullptr);
+
+// Encode 8-bit RGBA pixels (rows 'stride' bytes apart) into a PNG file image in 'out'.
+// numThreads == 0 uses every hardware thread.
+bool EncodePNG(std::vector<unsigned char>& out, const unsigned char* rgba, int width, int height, int stride,
+               PngCompression level, int numThreads = 0);
+bool EncodeQOI(std::vector<unsigned char>& out, const unsigned char* rgba, int width, int height, int stride);
+
+// Encode into any writable format; 'level' and 'numThreads' only apply to PNG
+bool EncodeImage(std::vector<unsigned char>& out, ImageFileFormat format, const unsigned char* rgba, int width, int height, int stride,
+                 PngCompression level = PngCompression_Fast, int numThreads = 0);
+bool EncodeImage(std::vector<unsigned char>& out, ImageFileFormat format, const ImageData& image,
+                 PngCompression level = PngCompression_Fast, int numThreads = 0);
+
+// EncodeImage + write to disk
+bool WriteImageFile(const std::string& path, ImageFileFormat format, const unsigned char* rgba, int width, int height, int stride,
+                    PngCompression level = PngCompression_Fast, int numThreads = 0);
+bool WriteImageFile(const std::string& path, ImageFileFormat format, const ImageData& image,
+                    PngCompression level = PngCompression_Fast, int numThreads = 0);
+
+// EncodePNG + write to disk
+bool WritePNG(const std::string& path, const unsigned char* rgba, int width, int height, int stride,
+              PngCompression level, int numThreads = 0);
+
+// Sequential top-to-bottom access to an image, a few rows at a time
+class ImageStripReader {
+public:
+    virtual ~ImageStripReader() = default;
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+    // Decode the next 'rowCount' rows as RGBA8 into 'dst' (rows 'dstStride' bytes apart)
+    virtual bool ReadRows(unsigned char* dst, int dstStride, int rowCount) = 0;
+
+    // Fill the pixels of 'rows' (RGBA8, at least Width() wide) with the next rows.height rows
+    bool ReadRows(const ImageBuffer& rows) {
+        return rows.format == PixelFormat_RGBA8 && rows.width >= width && ReadRows(rows.pixels, rows.stride, rows.height);
+    }
+
+protected:
+    int width = 0;
+    int height = 0;
+};
+
+// Open a PNG (not interlaced), PPM/PAM or raw file for strip reading. Returns nullptr for other
+// formats, which have to go through ReadImageFile.
+std::unique_ptr<ImageStripReader> OpenImageStripReader(const std::string& path);
+
+// Strip reader over an image already in memory, so both cases can share one code path
+std::unique_ptr<ImageStripReader> MakeMemoryStripReader(const ImageData& image);
+
+// Read all remaining rows of 'reader' into a box-filtered copy no larger than maxSize on either side
+bool ReadImagePreview(ImageStripReader& reader, int maxSize, ImageData& out, std::atomic<float>* progress = nullptr);
+
+// The same for an image in memory. An image that already fits is returned as is, not copied.
+bool MakeImagePreview(const ImageData& image, int maxSize, ImageData& out);
+
+// Encodes an image into a file as its rows arrive, top to bottom
+class ImageStripWriter {
+public:
+    virtual ~ImageStripWriter() = default;
+
+    // Append the next 'rowCount' rows of 8-bit RGBA (rows 'stride' bytes apart)
+    virtual bool WriteRows(const unsigned char* rgba, int stride, int rowCount) = 0;
+
+    // Append every row of 'rows', which must be RGBA8
+    bool WriteRows(const ImageData& rows) {
+        return rows.format == PixelFormat_RGBA8 && WriteRows(rows.pixels, rows.stride, rows.height);
+    }
+
+    // Close the file. False if a write failed or fewer rows than the height were written.
+    virtual bool Finish() = 0;
+};
+
+// Create 'path' for strip writing in any writable format; 'level' and 'numThreads' only apply to PNG
+std::unique_ptr<ImageStripWriter> OpenImageStripWriter(const std::string& path, ImageFileFormat format, int width, int height,
+                                                       PngCompression level = PngCompression_Fast, int numThreads = 0);
+
+// Encode and decode 'rgba' in every writable format and print size and throughput
+void BenchmarkImageFormats(const char* label, const unsigned char* rgba, int width, int height, int stride);
+
+// Check that streaming keeps memory bounded: write a synthetic 'size' x 'size' PNG to 'path' a
+// strip at a time, read a preview of it back the same way, and fail if the peak resident set
+// grew by more than a few strips' worth. Deletes the file and prints what it measured. For
+// --check-streaming.
+bool CheckStreamingMemory(const std::string& path, int size);
@@ -0,0 +1,377 @@
+// Numbered image sequences. See ImageSequence.h
+
+#include "ImageSequence.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <ctype.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include "dirent/dirent.h"
+#else
+#include <dirent.h>
+#endif
+
+//-----------------------------------------------------------------------------
+// Listing
+//-----------------------------------------------------------------------------
+
+static void SplitPath(const std::string& path, std::string& dir, std::string& name)
+{
+    size_t sep = path.find_last_of("/\\");
+    if (sep == std::string::npos) {
+        dir.clear();
+        name = path;
+    }
+    else {
+        dir = path.substr(0, sep + 1);
+        name = path.substr(sep + 1);
+    }
+}
+
+static bool IsImageFileName(const std::string& name)
+{
+    static const char* const Extensions[] = { "png", "qoi", "ppm", "pnm", "pam", "pfm", "raw", "jpg", "jpeg", "bmp", "tga", "gif", "psd", "hdr" };
+    size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos)
+        return false;
+    std::string ext = name.substr(dot + 1);
+    for (char& c : ext)
+        c = (char)tolower((unsigned char)c);
+    for (const char* e : Extensions)
+        if (ext == e)
+            return true;
+    return false;
+}
+
+// Names of the regular files in 'dir' ("" is the current directory)
+static bool ListDirectory(const std::string& dir, std::vector<std::string>& names)
+{
+    DIR* d = opendir(dir.empty() ? "." : dir.c_str());
+    if (!d)
+        return false;
+    while (struct dirent* entry = readdir(d)) {
+        if (entry->d_type == DT_DIR)
+            continue;
+        names.push_back(entry->d_name);
+    }
+    closedir(d);
+    return true;
+}
+
+// "frame2" < "frame10": runs of digits compare by value
+static bool NaturalLess(const std::string& a, const std::string& b)
+{
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (isdigit((unsigned char)a[i]) && isdigit((unsigned char)b[j])) {
+            size_t i2 = i, j2 = j;
+            while (i2 < a.size() && a[i2] == '0') i2++;
+            while (j2 < b.size() && b[j2] == '0') j2++;
+            size_t iEnd = i2, jEnd = j2;
+            while (iEnd < a.size() && isdigit((unsigned char)a[iEnd])) iEnd++;
+            while (jEnd < b.size() && isdigit((unsigned char)b[jEnd])) jEnd++;
+            if (iEnd - i2 != jEnd - j2)
+                return iEnd - i2 < jEnd - j2;
+            int c = a.compare(i2, iEnd - i2, b, j2, jEnd - j2);
+            if (c != 0)
+                return c < 0;
+            i = iEnd;
+            j = jEnd;
+        }
+        else {
+            if (a[i] != b[j])
+                return a[i] < b[j];
+            i++;
+            j++;
+        }
+    }
+    return a.size() - i < b.size() - j;
+}
+
+// Locate the frame number field of a file name: a run of '#', a printf "%d" / "%0Nd", or failing
+// those the last run of digits
+static bool FindFrameField(const std::string& name, size_t& start, size_t& length)
+{
+    size_t hash = name.find('#');
+    if (hash != std::string::npos) {
+        start = hash;
+        length = name.find_first_not_of('#', hash) - hash;
+        return true;
+    }
+    size_t percent = name.find('%');
+    if (percent != std::string::npos) {
+        size_t p = percent + 1;
+        while (p < name.size() && isdigit((unsigned char)name[p]))
+            p++;
+        if (p < name.size() && name[p] == 'd') {
+            start = percent;
+            length = p + 1 - percent;
+            return true;
+        }
+    }
+    size_t end = name.find_last_of("0123456789");
+    if (end == std::string::npos)
+        return false;
+    start = end;
+    while (start > 0 && isdigit((unsigned char)name[start - 1]))
+        start--;
+    length = end + 1 - start;
+    return true;
+}
+
+bool ListImageSequence(const std::string& patternOrDirectory, std::vector<SequenceFrame>& frames)
+{
+    frames.clear();
+    std::vector<std::string> names;
+
+    // A directory: every image in it
+    std::string dir = patternOrDirectory;
+    if (!dir.empty() && dir.back() != '/' && dir.back() != '\\')
+        dir += '/';
+    if (ListDirectory(dir, names)) {
+        names.erase(std::remove_if(names.begin(), names.end(), [](const std::string& n) { return !IsImageFileName(n); }), names.end());
+        std::sort(names.begin(), names.end(), NaturalLess);
+        for (size_t i = 0; i < names.size(); i++)
+            frames.push_back({ dir + names[i], (int)i });
+        return !frames.empty();
+    }
+
+    // A pattern: files that differ from it only in the digits of the frame field
+    std::string name;
+    SplitPath(patternOrDirectory, dir, name);
+    size_t start, length;
+    if (!FindFrameField(name, start, length) || !ListDirectory(dir, names))
+        return false;
+    std::string prefix = name.substr(0, start);
+    std::string suffix = name.substr(start + length);
+    for (const std::string& n : names) {
+        if (n.size() <= prefix.size() + suffix.size() || n.compare(0, prefix.size(), prefix) != 0 ||
+            n.compare(n.size() - suffix.size(), suffix.size(), suffix) != 0)
+            continue;
+        std::string digits = n.substr(prefix.size(), n.size() - prefix.size() - suffix.size());
+        if (digits.size() > 9 || digits.find_first_not_of("0123456789") != std::string::npos)
+            continue;
+        frames.push_back({ dir + n, atoi(digits.c_str()) });
+    }
+    std::sort(frames.begin(), frames.end(), [](const SequenceFrame& a, const SequenceFrame& b) { return a.number < b.number; });
+    return !frames.empty();
+}
+
+std::string FormatFramePath(const std::string& pattern, int number)
+{
+    std::string dir, name;
+    SplitPath(pattern, dir, name);
+    char digits[32];
+
+    size_t hash = name.find('#');
+    if (hash != std::string::npos) {
+        size_t length = name.find_first_not_of('#', hash) - hash;
+        snprintf(digits, sizeof(digits), "%0*d", (int)length, number);
+        return dir + name.substr(0, hash) + digits + name.substr(hash + length);
+    }
+    size_t percent = name.find('%');
+    if (percent != std::string::npos) {
+        size_t p = percent + 1;
+        int width = 0;
+        while (p < name.size() && isdigit((unsigned char)name[p]))
+            width = width * 10 + (name[p++] - '0');
+        if (p < name.size() && name[p] == 'd') {
+            snprintf(digits, sizeof(digits), "%0*d", std::min(width, 16), number);
+            return dir + name.substr(0, percent) + digits + name.substr(p + 1);
+        }
+    }
+    size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos)
+        dot = name.size();
+    snprintf(digits, sizeof(digits), "_%04d", number);
+    return dir + name.substr(0, dot) + digits + name.substr(dot);
+}
+
+//-----------------------------------------------------------------------------
+// Prefetching
+//-----------------------------------------------------------------------------
+
+enum SlotState { Slot_Empty, Slot_Loading, Slot_Ready, Slot_Failed };
+
+struct PrefetchSlot {
+    int index = -1;
+    SlotState state = Slot_Empty;
+    ImageData image;
+};
+
+struct SequencePrefetcher::State {
+    std::vector<SequenceFrame> frames;
+    std::vector<PrefetchSlot> slots;
+    int numThreads = 1;
+    int playhead = 0;
+    bool loop = false;
+    bool closed = false;
+    int decoding = 0;       // Decode tasks queued or running
+    std::mutex mutex;
+
+    // Frame 'offset' places after the playhead, -1 past the end
+    int WindowFrame(int offset) const {
+        int count = (int)frames.size();
+        if (offset >= count)
+            return -1;
+        int index = playhead + offset;
+        if (index >= count)
+            index = loop ? index - count : -1;
+        return index;
+    }
+
+    bool InWindow(int index) const {
+        int count = (int)frames.size();
+        int distance = index - playhead;
+        if (distance < 0) {
+            if (!loop)
+                return false;
+            distance += count;
+        }
+        return distance < std::min((int)slots.size(), count);
+    }
+
+    PrefetchSlot* FindSlot(int index) {
+        for (PrefetchSlot& slot : slots)
+            if (slot.state != Slot_Empty && slot.index == index)
+                return &slot;
+        return nullptr;
+    }
+};
+
+SequencePrefetcher::SequencePrefetcher(int ringSize, int threads)
+    : ringSize(ringSize > 0 ? ringSize : 1), numThreads(threads > 0 ? threads : 1)
+{
+}
+
+SequencePrefetcher::~SequencePrefetcher()
+{
+    Close();
+}
+
+void SequencePrefetcher::Open(const std::vector<SequenceFrame>& sequence, bool loopPlayback)
+{
+    Close();
+    state = std::make_shared<State>();
+    state->frames = sequence;
+    state->slots.resize(ringSize);
+    state->numThreads = numThreads;
+    state->loop = loopPlayback;
+    std::lock_guard<std::mutex> lock(state->mutex);
+    StartDecodes(state);
+}
+
+void SequencePrefetcher::Close()
+{
+    if (!state)
+        return;
+    // Decodes still running hold the state and drop their frame when they see it closed
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->closed = true;
+        for (PrefetchSlot& slot : state->slots)
+            slot = PrefetchSlot();
+    }
+    state = nullptr;
+}
+
+void SequencePrefetcher::Seek(int index)
+{
+    if (!state)
+        return;
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (index < 0 || index >= (int)state->frames.size() || index == state->playhead)
+        return;
+    state->playhead = index;
+    StartDecodes(state);
+}
+
+void SequencePrefetcher::SetLoop(bool loopPlayback)
+{
+    if (!state)
+        return;
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->loop = loopPlayback;
+    StartDecodes(state);
+}
+
+void SequencePrefetcher::StartDecodes(const std::shared_ptr<State>& state)
+{
+    while (!state->closed && state->decoding < state->numThreads) {
+        int index = -1;
+        for (int offset = 0; offset < (int)state->slots.size(); offset++) {
+            int f = state->WindowFrame(offset);
+            if (f < 0)
+                break;
+            if (!state->FindSlot(f)) {
+                index = f;
+                break;
+            }
+        }
+        PrefetchSlot* slot = nullptr;
+        if (index >= 0) {
+            for (PrefetchSlot& s : state->slots) {
+                if (s.state == Slot_Empty || (s.state != Slot_Loading && !state->InWindow(s.index))) {
+                    slot = &s;
+                    break;
+                }
+            }
+        }
+        if (!slot)
+            return;
+
+        // Claim the slot and drop the evicted frame before decoding, so at most 'ringSize'
+        // frames are ever held
+        slot->index = index;
+        slot->state = Slot_Loading;
+        slot->image = ImageData();
+        state->decoding++;
+        std::string path = state->frames[index].path;
+        ScopedTaskPriority priority(TaskPriority_Background);
+        RunDetached([state, slot, index, path]() {
+            ImageData image;
+            bool ok = ReadImageFile(path, image);
+
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->decoding--;
+            if (state->closed)
+                return;
+            // Loading slots are never reclaimed, so the slot is still this frame's
+            slot->image = ok ? image : ImageData();
+            slot->state = ok ? Slot_Ready : Slot_Failed;
+            StartDecodes(state);
+        });
+    }
+}
+
+bool SequencePrefetcher::TryGet(int index, ImageData& out)
+{
+    if (!state)
+        return false;
+    std::lock_guard<std::mutex> lock(state->mutex);
+    PrefetchSlot* slot = state->FindSlot(index);
+    if (!slot || slot->state != Slot_Ready)
+        return false;
+    out = slot->image;
+    return true;
+}
+
+int SequencePrefetcher::BufferedAhead()
+{
+    if (!state)
+        return 0;
+    std::lock_guard<std::mutex> lock(state->mutex);
+    int count = 0;
+    for (int offset = 0; offset < (int)state->slots.size(); offset++) {
+        int f = state->WindowFrame(offset);
+        PrefetchSlot* slot = f >= 0 ? state->FindSlot(f) : nullptr;
+        if (!slot || slot->state != Slot_Ready)
+            break;
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,63 @@
+// Numbered image sequences: finding the frames on disk and decoding ahead of playback.
+//
+// A sequence is given either as a directory (every image in it, in natural order) or as a
+// file pattern: "shot_####.png", "shot_%04d.png", or simply the path of any one frame, in which
+// case the last run of digits in the file name is taken as the frame number.
+//
+// SequencePrefetcher keeps a fixed ring of decoded frames starting at the playhead. Decode tasks
+// on the thread pool fill it in order, so reading, decoding and whatever the consumer does with
+// the current frame all overlap. Nothing in it blocks: the consumer polls with TryGet, and
+// closing lets decodes still running finish on their own.
+
+#pragma once
+
+#include "ImageIO.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+struct SequenceFrame {
+    std::string path;
+    int number = 0;     // Frame number from the file name, or the index for directory listings
+};
+
+// List the frames of a sequence, sorted by frame number. False if nothing matched.
+bool ListImageSequence(const std::string& patternOrDirectory, std::vector<SequenceFrame>& frames);
+
+// Substitute a frame number into an output pattern ("####" or "%04d"). Patterns without a
+// placeholder get "_0000" style numbering inserted before the extension.
+std::string FormatFramePath(const std::string& pattern, int number);
+
+class SequencePrefetcher {
+public:
+    // 'ringSize' frames are kept decoded; up to 'numThreads' decode tasks run in parallel
+    explicit SequencePrefetcher(int ringSize = 8, int numThreads = 2);
+    ~SequencePrefetcher();
+    SequencePrefetcher(const SequencePrefetcher&) = delete;
+    SequencePrefetcher& operator=(const SequencePrefetcher&) = delete;
+
+    void Open(const std::vector<SequenceFrame>& frames, bool loop);
+    void Close();
+
+    // Move the playhead. The ring is refilled from here on; frames behind it are evicted first.
+    void Seek(int index);
+    void SetLoop(bool loop);
+
+    // Copy of a decoded frame if it is in the ring, without blocking
+    bool TryGet(int index, ImageData& out);
+
+    // Frames decoded and ready from the playhead on, for display
+    int BufferedAhead();
+    int RingSize() const { return ringSize; }
+
+private:
+    struct State;   // Shared with the decode tasks, which keep it alive after Close()
+
+    // Start decode tasks for the first frames of the window that nobody has started on, up to
+    // numThreads at a time. Called with the lock held, after anything that may have made room.
+    static void StartDecodes(const std::shared_ptr<State>& state);
+
+    int ringSize;
+    int numThreads;
+    std::shared_ptr<State> state;
+};
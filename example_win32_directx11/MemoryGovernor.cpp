@@ -0,0 +1,502 @@
+// Memory budget, image cache and spill file. See MemoryGovernor.h
+
+#include "MemoryGovernor.h"
+#include "BufferPool.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Reading a spilled entry back costs about this much. Entries slower than that to recompute are
+// worth spilling, cheaper ones are simply dropped.
+static const double SpillReadBytesPerSecond = 500.0 * 1024 * 1024;
+
+// Regions of the scratch file start on this boundary, which suits MapViewOfFile (64 KB
+// allocation granularity) and mmap (pages) alike
+static const size_t SpillAlignment = 64 * 1024;
+
+// Spilled entries may add up to this many times the budget. Beyond it the spilled entries
+// cheapest to recompute per byte are dropped to make room, or the new one is if it is cheaper.
+static const size_t SpillBudgetFactor = 4;
+
+// Part of the budget the buffer pool may keep cached for reuse
+static size_t PoolLimitFor(size_t budget)
+{
+    return std::min(budget / 4, (size_t)512 << 20);
+}
+
+static size_t PhysicalMemory()
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX status = {};
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+        return (size_t)status.ullTotalPhys;
+#else
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pageSize > 0)
+        return (size_t)pages * (size_t)pageSize;
+#endif
+    return (size_t)8 << 30;
+}
+
+// Temporary file that is deleted when closed. Regions are mapped one at a time and go back on a
+// free list when their last view is released, so the file only grows when nothing fits.
+class SpillFile {
+public:
+    ~SpillFile() { Close(); }
+
+    // Reserve 'bytes' and map them writable. False if the file can't be created or grown.
+    bool Allocate(size_t bytes, size_t& offset, unsigned char*& view);
+    void Free(size_t offset, size_t bytes, unsigned char* view);
+    size_t BytesUsed();
+
+private:
+    bool Open();
+    void Close();
+
+    std::mutex mutex;
+    std::vector<std::pair<size_t, size_t>> freeRegions;    // Offset and size, sorted by offset
+    size_t end = 0;
+    size_t used = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+};
+
+bool SpillFile::Open()
+{
+#ifdef _WIN32
+    if (file != INVALID_HANDLE_VALUE)
+        return true;
+    char dir[MAX_PATH];
+    char name[MAX_PATH];
+    if (!GetTempPathA(MAX_PATH, dir) || !GetTempFileNameA(dir, "spl", 0, name))
+        return false;
+    file = CreateFileA(name, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                       FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+    return file != INVALID_HANDLE_VALUE;
+#else
+    if (fd >= 0)
+        return true;
+    const char* dir = getenv("TMPDIR");
+    std::string path = std::string(dir && *dir ? dir : "/tmp") + "/node-editor-spill-XXXXXX";
+    fd = mkstemp(&path[0]);
+    if (fd < 0)
+        return false;
+    unlink(path.c_str());   // Gone from the directory now, freed when closed
+    return true;
+#endif
+}
+
+void SpillFile::Close()
+{
+#ifdef _WIN32
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+#endif
+}
+
+bool SpillFile::Allocate(size_t bytes, size_t& offset, unsigned char*& view)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!Open())
+        return false;
+    size_t size = (bytes + SpillAlignment - 1) / SpillAlignment * SpillAlignment;
+
+    // First fit among freed regions, otherwise append
+    offset = end;
+    for (size_t i = 0; i < freeRegions.size(); i++) {
+        if (freeRegions[i].second >= size) {
+            offset = freeRegions[i].first;
+            freeRegions[i].first += size;
+            freeRegions[i].second -= size;
+            if (freeRegions[i].second == 0)
+                freeRegions.erase(freeRegions.begin() + i);
+            break;
+        }
+    }
+    bool appended = offset == end;
+
+#ifdef _WIN32
+    ULARGE_INTEGER limit;
+    limit.QuadPart = offset + size;
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, limit.HighPart, limit.LowPart, nullptr);
+    void* p = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, (DWORD)((unsigned long long)offset >> 32), (DWORD)offset, size) : nullptr;
+    if (mapping)
+        CloseHandle(mapping);   // The view keeps the mapping alive
+#else
+    void* p = nullptr;
+    if (!appended || ftruncate(fd, (off_t)(offset + size)) == 0) {
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)offset);
+        if (p == MAP_FAILED)
+            p = nullptr;
+    }
+#endif
+    if (!p) {
+        if (!appended)
+            freeRegions.insert(std::lower_bound(freeRegions.begin(), freeRegions.end(), std::make_pair(offset, (size_t)0)),
+                               std::make_pair(offset, size));
+        return false;
+    }
+    if (appended)
+        end += size;
+    used += size;
+    view = (unsigned char*)p;
+    return true;
+}
+
+void SpillFile::Free(size_t offset, size_t bytes, unsigned char* view)
+{
+    size_t size = (bytes + SpillAlignment - 1) / SpillAlignment * SpillAlignment;
+#ifdef _WIN32
+    UnmapViewOfFile(view);
+#else
+    munmap(view, size);
+#endif
+    std::lock_guard<std::mutex> lock(mutex);
+    used -= size;
+
+    // Insert in offset order and merge with the neighbours
+    auto it = freeRegions.insert(std::lower_bound(freeRegions.begin(), freeRegions.end(), std::make_pair(offset, (size_t)0)),
+                                 std::make_pair(offset, size));
+    auto next = it + 1;
+    if (next != freeRegions.end() && it->first + it->second == next->first) {
+        it->second += next->second;
+        freeRegions.erase(next);
+    }
+    if (it != freeRegions.begin()) {
+        auto prev = it - 1;
+        if (prev->first + prev->second == it->first) {
+            prev->second += it->second;
+            freeRegions.erase(it);
+        }
+    }
+}
+
+size_t SpillFile::BytesUsed()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+}
+
+// A spilled image's place in the scratch file, returned when the last view of it goes away
+struct SpillRegion {
+    SpillFile* file;
+    size_t offset;
+    size_t bytes;
+    unsigned char* view;
+
+    SpillRegion(SpillFile* file, size_t offset, size_t bytes, unsigned char* view) : file(file), offset(offset), bytes(bytes), view(view) {}
+    ~SpillRegion() { file->Free(offset, bytes, view); }
+    SpillRegion(const SpillRegion&) = delete;
+    SpillRegion& operator=(const SpillRegion&) = delete;
+};
+
+struct CacheEntry {
+    ImageData image;                // Resident pixels, or a view of the spill file
+    size_t bytes = 0;
+    double recomputeSeconds = 0.0;
+    bool spilled = false;
+};
+
+struct Governor {
+    std::mutex mutex;
+    size_t budget = 0;
+    std::unordered_map<std::string, CacheEntry> entries;
+    SpillFile spill;
+    unsigned long long evictions = 0;
+    unsigned long long spills = 0;
+
+    Governor() {
+        budget = PhysicalMemory() / 4;
+        SetBufferPoolLimit(PoolLimitFor(budget));
+    }
+};
+
+// Never destroyed, like the buffer pool: cached images may be released from static destructors
+static Governor& GetGovernor()
+{
+    static Governor* governor = new Governor();
+    return *governor;
+}
+
+static size_t CurrentUsage()
+{
+    BufferPoolStats stats = GetBufferPoolStats();
+    return stats.bytesInUse + stats.bytesCached;
+}
+
+static double RecomputeSecondsPerByte(const CacheEntry& entry)
+{
+    return entry.recomputeSeconds / entry.bytes;
+}
+
+// Drop spilled entries cheaper to recompute per byte than 'entry', cheapest first, until it
+// fits within the spill budget too, counting 'pending' bytes that are being copied out already.
+// False if it doesn't. Called with the lock held. The dropped views are released right away,
+// which only unmaps them, so their regions of the scratch file are free for the entry.
+static bool MakeSpillRoom(Governor& governor, const CacheEntry& entry, size_t pending)
+{
+    size_t limit = governor.budget * SpillBudgetFactor;
+    size_t spilled = pending;
+    std::vector<std::pair<double, std::string>> victims;
+    for (auto& it : governor.entries) {
+        if (!it.second.spilled)
+            continue;
+        spilled += it.second.bytes;
+        if (RecomputeSecondsPerByte(it.second) < RecomputeSecondsPerByte(entry))
+            victims.push_back(std::make_pair(RecomputeSecondsPerByte(it.second), it.first));
+    }
+    std::sort(victims.begin(), victims.end());
+
+    for (auto& victim : victims) {
+        if (spilled + entry.bytes <= limit)
+            break;
+        auto it = governor.entries.find(victim.second);
+        spilled -= it->second.bytes;
+        governor.entries.erase(it);
+        governor.evictions++;
+    }
+    return spilled + entry.bytes <= limit;
+}
+
+// An entry on its way to the scratch file. Its region is reserved under the lock, the pixels are
+// copied without it, and the entry is pointed at the copy under the lock again.
+struct PendingSpill {
+    std::string key;
+    ImageData source;                       // Keeps the pixels alive while they are copied
+    std::shared_ptr<SpillRegion> region;    // Freed again if the spill is abandoned
+};
+
+// Reserve room in the scratch file for a resident entry. Called with the lock held.
+static bool ReserveSpill(Governor& governor, const std::string& key, const CacheEntry& entry, size_t pending,
+                         std::vector<PendingSpill>& spills)
+{
+    if (!MakeSpillRoom(governor, entry, pending))
+        return false;
+    size_t offset = 0;
+    unsigned char* view = nullptr;
+    if (!governor.spill.Allocate(entry.bytes, offset, view))
+        return false;
+    PendingSpill spill;
+    spill.key = key;
+    spill.source = entry.image;
+    spill.region = std::make_shared<SpillRegion>(&governor.spill, offset, entry.bytes, view);
+    spills.push_back(std::move(spill));
+    return true;
+}
+
+// Copy the pixels out. Called without the lock: this is the slow part.
+static void CopySpill(const PendingSpill& spill)
+{
+    memcpy(spill.region->view, spill.source.pixels, spill.region->bytes);
+
+    // Start writing the pages back now, so they are clean and cheap for the OS to drop
+#ifdef _WIN32
+    FlushViewOfFile(spill.region->view, spill.region->bytes);
+#else
+    msync(spill.region->view, spill.region->bytes, MS_ASYNC);
+#endif
+}
+
+// Point the entry at its copy, unless it was replaced, erased or spilled by someone else while
+// the copy was made. Called with the lock held.
+static void FinishSpill(Governor& governor, PendingSpill& spill, std::vector<ImageData>& released)
+{
+    auto it = governor.entries.find(spill.key);
+    if (it == governor.entries.end() || it->second.spilled || it->second.image.pixels != spill.source.pixels)
+        return;
+    CacheEntry& entry = it->second;
+    ImageData spilled = entry.image;
+    spilled.pixels = spill.region->view;
+    spilled.owner = spill.region;
+    released.push_back(std::move(entry.image));
+    entry.image = std::move(spilled);
+    entry.spilled = true;
+    governor.spills++;
+}
+
+void SetMemoryBudget(size_t bytes)
+{
+    Governor& governor = GetGovernor();
+    {
+        std::lock_guard<std::mutex> lock(governor.mutex);
+        governor.budget = bytes;
+    }
+    SetBufferPoolLimit(PoolLimitFor(bytes));
+}
+
+size_t GetMemoryBudget()
+{
+    Governor& governor = GetGovernor();
+    std::lock_guard<std::mutex> lock(governor.mutex);
+    return governor.budget;
+}
+
+void CachePut(const std::string& key, const ImageData& image, double recomputeSeconds)
+{
+    Governor& governor = GetGovernor();
+    CacheEntry entry;
+    entry.image = image;
+    entry.bytes = (size_t)image.stride * image.height;
+    entry.recomputeSeconds = recomputeSeconds;
+    {
+        std::lock_guard<std::mutex> lock(governor.mutex);
+        if (!image.pixels || entry.bytes > governor.budget / 2) {
+            return;     // Would evict everything else to make room for itself
+        }
+        std::swap(governor.entries[key], entry);
+    }
+    entry = CacheEntry();   // The replaced entry, released outside the lock
+    EnforceMemoryBudget();
+}
+
+bool CacheGet(const std::string& key, ImageData& out)
+{
+    Governor& governor = GetGovernor();
+    std::lock_guard<std::mutex> lock(governor.mutex);
+    auto it = governor.entries.find(key);
+    if (it == governor.entries.end())
+        return false;
+    out = it->second.image;
+    return true;
+}
+
+void CacheErase(const std::string& key)
+{
+    Governor& governor = GetGovernor();
+    CacheEntry entry;
+    {
+        std::lock_guard<std::mutex> lock(governor.mutex);
+        auto it = governor.entries.find(key);
+        if (it == governor.entries.end())
+            return;
+        entry = std::move(it->second);
+        governor.entries.erase(it);
+    }
+}
+
+void EnforceMemoryBudget()
+{
+    Governor& governor = GetGovernor();
+    size_t budget = GetMemoryBudget();
+    if (CurrentUsage() <= budget)
+        return;
+
+    // Free buffers first: nothing has to be recomputed to get them back
+    TrimBufferPool();
+    size_t usage = CurrentUsage();
+    if (usage <= budget)
+        return;
+
+    std::vector<ImageData> released;   // Freed after unlocking
+    std::vector<PendingSpill> spills;
+    {
+        std::lock_guard<std::mutex> lock(governor.mutex);
+
+        // Cheapest to recompute per byte first. Spilled entries take no memory; they only make
+        // way for others in the scratch file.
+        std::vector<std::pair<double, std::string>> candidates;
+        for (auto& it : governor.entries) {
+            if (!it.second.spilled && it.second.bytes > 0)
+                candidates.push_back(std::make_pair(RecomputeSecondsPerByte(it.second), it.first));
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        size_t pending = 0;
+        for (auto& candidate : candidates) {
+            if (usage <= budget)
+                break;
+            auto it = governor.entries.find(candidate.second);
+            if (it == governor.entries.end())
+                continue;   // Made room for a spill
+            CacheEntry& entry = it->second;
+            size_t bytes = entry.bytes;
+            bool expensive = entry.recomputeSeconds > bytes / SpillReadBytesPerSecond;
+            if (expensive && ReserveSpill(governor, it->first, entry, pending, spills)) {
+                pending += bytes;
+            }
+            else {
+                released.push_back(std::move(entry.image));
+                governor.entries.erase(it);
+                governor.evictions++;
+            }
+            // Assumes the cache held the only reference; if not, the pixels are freed later
+            usage -= std::min(usage, bytes);
+        }
+    }
+    released.clear();
+
+    for (const PendingSpill& spill : spills)
+        CopySpill(spill);
+    {
+        std::lock_guard<std::mutex> lock(governor.mutex);
+        for (PendingSpill& spill : spills)
+            FinishSpill(governor, spill, released);
+    }
+    spills.clear();
+    released.clear();
+
+    // What eviction freed landed on the pool's free lists
+    TrimBufferPool();
+}
+
+void RequestMemoryBudget()
+{
+    static std::atomic<bool> queued(false);
+    if (CurrentUsage() <= GetMemoryBudget() || queued.exchange(true))
+        return;
+    ScopedTaskPriority scope(TaskPriority_Background);
+    RunDetached([]() {
+        EnforceMemoryBudget();
+        queued = false;
+    });
+}
+
+MemoryGovernorStats GetMemoryGovernorStats()
+{
+    Governor& governor = GetGovernor();
+    MemoryGovernorStats stats;
+    stats.usage = CurrentUsage();
+    std::lock_guard<std::mutex> lock(governor.mutex);
+    stats.budget = governor.budget;
+    stats.entries = (int)governor.entries.size();
+    for (auto& it : governor.entries) {
+        if (it.second.spilled)
+            stats.spilledBytes += it.second.bytes;
+        else
+            stats.residentBytes += it.second.bytes;
+    }
+    stats.evictions = governor.evictions;
+    stats.spills = governor.spills;
+    return stats;
+}
@@ -0,0 +1,53 @@
+// One memory budget for everything that keeps pixels around after it is done with them.
+//
+// Decoded inputs and evaluation results are cached under a key, together with how long they
+// took to produce. Those caches and the buffer pool's free lists all count against a single
+// cap. When usage goes over it, the governor first returns the pool's cached buffers to the OS
+// (they cost nothing to get back), then evicts cache entries, cheapest to recompute per byte
+// first. An entry that would take longer to recompute than to read back from disk is not
+// dropped but spilled: copied into a memory-mapped scratch file, where its pages are backed by
+// the file and the OS can page them out instead of killing the process. Looking up a spilled
+// entry returns a view of the mapping, without copying it back. Spilled entries are capped at a
+// multiple of the budget; past that they are evicted in the same order.
+//
+// Several editors or batch workers can run side by side by giving each a share of the machine
+// with SetMemoryBudget (the default is a quarter of physical memory).
+
+#pragma once
+
+#include "ImageIO.h"
+#include <cstddef>
+#include <string>
+
+// Cap for the buffer pool and the caches together. Applied on the next EnforceMemoryBudget().
+void SetMemoryBudget(size_t bytes);
+size_t GetMemoryBudget();
+
+// Cache 'image' under 'key', replacing any previous entry. 'recomputeSeconds' is what it cost
+// to produce, which decides what is evicted or spilled first. Enforces the budget.
+void CachePut(const std::string& key, const ImageData& image, double recomputeSeconds);
+
+// Look up a cached image, resident or spilled. The result stays valid after eviction.
+bool CacheGet(const std::string& key, ImageData& out);
+
+// Drop an entry that is out of date, e.g. because its file changed
+void CacheErase(const std::string& key);
+
+// Trim, evict and spill until usage is under the budget. Cheap when it already is. Spilling
+// copies whole images, so the UI thread calls RequestMemoryBudget instead.
+void EnforceMemoryBudget();
+
+// For the UI thread, every frame: only compares usage with the budget, and when it is over,
+// queues EnforceMemoryBudget on the thread pool unless it is queued already
+void RequestMemoryBudget();
+
+struct MemoryGovernorStats {
+    size_t budget = 0;
+    size_t usage = 0;               // Buffer pool memory in use or cached, caches included
+    int entries = 0;
+    size_t residentBytes = 0;       // Cache entries held in memory
+    size_t spilledBytes = 0;        // Cache entries in the scratch file
+    unsigned long long evictions = 0;
+    unsigned long long spills = 0;
+};
+MemoryGovernorStats GetMemoryGovernorStats();
@@ -0,0 +1,82 @@
+// Buffer assignment for graph evaluations. See MemoryPlanner.h
+
+#include "MemoryPlanner.h"
+
+bool PlanMemory(const std::vector<PlanNode>& nodes, MemoryPlan& plan)
+{
+    const int count = (int)nodes.size();
+    plan = MemoryPlan();
+    plan.bufferOf.assign(count, -1);
+    plan.inPlace.assign(count, false);
+
+    // Liveness: how many readers each output has and which one reads it last
+    std::vector<int> readers(count, 0);
+    std::vector<int> lastUse(count, -1);
+    for (int i = 0; i < count; i++) {
+        for (int input : nodes[i].inputs) {
+            if (input < 0 || input >= i)
+                return false;
+            readers[input]++;
+            lastUse[input] = i;
+        }
+        plan.unplannedBytes += nodes[i].outputBytes;
+    }
+
+    std::vector<int> freeBuffers;
+    for (int i = 0; i < count; i++) {
+        const PlanNode& node = nodes[i];
+
+        // Take over the input's buffer if nothing else will read it
+        if (node.elementwise && !node.inputs.empty()) {
+            int input = node.inputs[0];
+            int buffer = plan.bufferOf[input];
+            if (readers[input] == 1 && !nodes[input].keepOutput && buffer >= 0 && plan.bufferSizes[buffer] >= node.outputBytes) {
+                plan.bufferOf[i] = buffer;
+                plan.inPlace[i] = true;
+                plan.bufferOf[input] = -1;      // Handed over, not released below
+            }
+        }
+
+        // Otherwise the smallest free buffer that fits, or a new one
+        if (!plan.inPlace[i] && node.outputBytes > 0) {
+            int best = -1;
+            for (int f = 0; f < (int)freeBuffers.size(); f++) {
+                size_t size = plan.bufferSizes[freeBuffers[f]];
+                if (size >= node.outputBytes && (best < 0 || size < plan.bufferSizes[freeBuffers[best]]))
+                    best = f;
+            }
+            if (best >= 0) {
+                plan.bufferOf[i] = freeBuffers[best];
+                freeBuffers.erase(freeBuffers.begin() + best);
+            }
+            else {
+                plan.bufferOf[i] = (int)plan.bufferSizes.size();
+                plan.bufferSizes.push_back(node.outputBytes);
+            }
+        }
+
+        // Inputs read for the last time are dead now
+        for (int input : node.inputs) {
+            if (lastUse[input] == i && !nodes[input].keepOutput && plan.bufferOf[input] >= 0) {
+                bool listed = false;
+                for (int f : freeBuffers)
+                    listed |= f == plan.bufferOf[input];
+                if (!listed)
+                    freeBuffers.push_back(plan.bufferOf[input]);
+            }
+        }
+        // An output nobody reads is dead as soon as it is written
+        if (readers[i] == 0 && !node.keepOutput && plan.bufferOf[i] >= 0)
+            freeBuffers.push_back(plan.bufferOf[i]);
+    }
+
+    // Give handed-over outputs their buffer back, so callers can look up what each node reads
+    for (int i = count - 1; i >= 0; i--) {
+        if (plan.inPlace[i])
+            plan.bufferOf[nodes[i].inputs[0]] = plan.bufferOf[i];
+    }
+
+    for (size_t size : plan.bufferSizes)
+        plan.peakBytes += size;
+    return true;
+}
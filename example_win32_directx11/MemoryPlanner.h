@@ -0,0 +1,30 @@
+// Assigns physical buffers to the intermediate results of a graph evaluation.
+//
+// Nodes are given in topological order. A node's output is live from the node that produces it
+// to the last node that reads it; after that its buffer goes back to a free list and the next
+// output of a fitting size reuses it. An elementwise node whose input has no other reader
+// writes over that input in place and needs no buffer of its own. A chain of elementwise nodes
+// therefore runs in one buffer, and any chain in at most two, whatever its length.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+struct PlanNode {
+    std::vector<int> inputs;        // Indices of earlier nodes whose outputs this node reads
+    size_t outputBytes = 0;
+    bool elementwise = false;       // Each output pixel only depends on the same input pixel
+    bool keepOutput = false;        // Output is a result of the evaluation: live until the end
+};
+
+struct MemoryPlan {
+    std::vector<int> bufferOf;          // Physical buffer holding each node's output
+    std::vector<bool> inPlace;          // Node overwrites its first input
+    std::vector<size_t> bufferSizes;    // Size of each physical buffer
+    size_t peakBytes = 0;               // Sum of bufferSizes: memory the evaluation needs
+    size_t unplannedBytes = 0;          // Memory without reuse: every output in its own buffer
+};
+
+// False if 'nodes' is not in topological order
+bool PlanMemory(const std::vector<PlanNode>& nodes, MemoryPlan& plan);
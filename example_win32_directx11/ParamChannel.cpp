@@ -0,0 +1,108 @@
+// Stress check for ParamChannel. See ParamChannel.h
+
+#include "ParamChannel.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Several words and a double, like a node's parameters. Every field follows from 'serial', so
+// a copy mixing two edits shows up as fields that disagree.
+struct CheckParams {
+    unsigned int serial = 0;
+    unsigned int words[6] = {};
+    double scale = 0.0;
+
+    static CheckParams Make(unsigned int serial) {
+        CheckParams p;
+        p.serial = serial;
+        for (int i = 0; i < 6; i++)
+            p.words[i] = serial * (2 * i + 3) + i;
+        p.scale = serial * 0.5;
+        return p;
+    }
+
+    bool Consistent() const {
+        for (int i = 0; i < 6; i++)
+            if (words[i] != serial * (2 * i + 3) + i)
+                return false;
+        return scale == serial * 0.5;
+    }
+};
+
+bool CheckParamChannel()
+{
+    const int Channels = 4;
+    const auto Duration = std::chrono::seconds(1);
+    const int Readers = std::max(2, (int)std::thread::hardware_concurrency());
+
+    std::vector<std::unique_ptr<ParamChannel<CheckParams>>> channels;
+    for (int c = 0; c < Channels; c++)
+        channels.emplace_back(new ParamChannel<CheckParams>(CheckParams::Make(0)));
+
+    std::atomic<int> writersDone(0);
+    unsigned int published[Channels] = {};     // Read once writersDone says they are final
+    std::atomic<unsigned long long> reads(0), torn(0), backwards(0), mismatched(0);
+    auto start = std::chrono::steady_clock::now();
+
+    // One writer per channel, as in the app: each node is edited from the UI thread only
+    std::vector<std::thread> threads;
+    for (int c = 0; c < Channels; c++) {
+        threads.emplace_back([&, c]() {
+            unsigned int i = 0;
+            // Bursts of edits with a yield in between, so readers make progress on few cores
+            while (std::chrono::steady_clock::now() - start < Duration) {
+                for (int n = 0; n < 16; n++)
+                    channels[c]->Publish(CheckParams::Make(++i));
+                std::this_thread::yield();
+            }
+            published[c] = i;
+            writersDone++;
+        });
+    }
+    for (int r = 0; r < Readers; r++) {
+        threads.emplace_back([&]() {
+            unsigned int last[Channels] = {};
+            unsigned long long localReads = 0, localTorn = 0, localBackwards = 0, localMismatched = 0;
+            // Keep reading until every writer finished, then once more to see the final values
+            for (bool more = true; more; ) {
+                more = writersDone < Channels;
+                for (int c = 0; c < Channels; c++) {
+                    unsigned int version;
+                    CheckParams p = channels[c]->Read(&version);
+                    localReads++;
+                    if (!p.Consistent())
+                        localTorn++;
+                    if (p.serial != version)
+                        localMismatched++;
+                    if (version < last[c])
+                        localBackwards++;
+                    last[c] = version;
+                }
+            }
+            for (int c = 0; c < Channels; c++)
+                if (last[c] != published[c])
+                    localBackwards++;
+            reads += localReads;
+            torn += localTorn;
+            backwards += localBackwards;
+            mismatched += localMismatched;
+        });
+    }
+    for (std::thread& t : threads)
+        t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    unsigned long long publishes = 0;
+    for (int c = 0; c < Channels; c++)
+        publishes += published[c];
+    bool ok = torn == 0 && backwards == 0 && mismatched == 0;
+    printf("%d channels, %d readers: %llu publishes and %llu reads in %.2f s, %llu torn, %llu out of order, %llu with the wrong version\n",
+           Channels, Readers, publishes, (unsigned long long)reads, seconds, (unsigned long long)torn,
+           (unsigned long long)backwards, (unsigned long long)mismatched);
+    printf("%s\n", ok ? "OK" : "FAILED: a reader saw an inconsistent copy");
+    return ok;
+}
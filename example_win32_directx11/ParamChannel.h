@@ -0,0 +1,73 @@
+// Parameters published by the UI thread and read by evaluation workers, without locks.
+//
+// A node's parameters are one small plain struct. The UI edits its own copy and publishes it
+// after every change; workers take a snapshot whenever they start an evaluation. The channel is
+// a sequence lock: the writer makes the sequence odd, stores the struct and makes it even again,
+// and a reader retries until it saw the same even sequence before and after its copy. Neither
+// side ever waits for the other, and a reader can never see half of one edit and half of
+// another. The struct is stored as atomic words, so there is no data race even while a reader
+// copies over a write it is about to discard.
+//
+// One writer only (the UI thread). Any number of readers.
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+template <class T>
+class ParamChannel {
+    static_assert(std::is_trivially_copyable<T>::value, "parameters are copied as raw words");
+
+public:
+    explicit ParamChannel(const T& initial = T()) { Store(initial); }
+
+    // Writer only
+    void Publish(const T& value) {
+        unsigned int s = sequence.load(std::memory_order_relaxed);
+        sequence.store(s + 1, std::memory_order_relaxed);
+        Store(value);       // Release: a reader that sees any new word sees the odd sequence too
+        sequence.store(s + 2, std::memory_order_release);
+    }
+
+    // A consistent copy of the last published value. 'version', if given, receives how many
+    // times it had been published.
+    T Read(unsigned int* version = nullptr) const {
+        unsigned int words[WordCount];
+        unsigned int before, after;
+        do {
+            before = sequence.load(std::memory_order_acquire);
+            for (int i = 0; i < WordCount; i++)
+                words[i] = data[i].load(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        T value;
+        memcpy(&value, words, sizeof(T));
+        if (version)
+            *version = before / 2;
+        return value;
+    }
+
+    // Times Publish has completed
+    unsigned int Version() const { return sequence.load(std::memory_order_acquire) / 2; }
+
+private:
+    static const int WordCount = (int)((sizeof(T) + sizeof(unsigned int) - 1) / sizeof(unsigned int));
+
+    void Store(const T& value) {
+        unsigned int words[WordCount] = {};
+        memcpy(words, &value, sizeof(T));
+        for (int i = 0; i < WordCount; i++)
+            data[i].store(words[i], std::memory_order_release);
+    }
+
+    std::atomic<unsigned int> sequence{ 0 };
+    std::atomic<unsigned int> data[WordCount];
+};
+
+// Stress the channel: a writer thread per channel publishes as fast as it can while reader
+// threads copy every channel in a loop, and each copy is checked for words from different
+// edits and for versions that go backwards. Meant to be run under ThreadSanitizer too. Prints
+// what it measured. For --check-params.
+bool CheckParamChannel();
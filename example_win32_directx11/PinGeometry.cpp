@@ -0,0 +1,82 @@
+// Pin hit testing and string interning. See PinGeometry.h
+
+#include "PinGeometry.h"
+
+void PinGeometry::BeginUpdate()
+{
+    update++;
+}
+
+void PinGeometry::Set(int pinId, float x, float y, float radius, int owner)
+{
+    int slot;
+    auto it = slotOf.find(pinId);
+    if (it != slotOf.end()) {
+        slot = it->second;
+    }
+    else if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+        slotOf.emplace(pinId, slot);
+    }
+    else {
+        slot = (int)xs.size();
+        xs.push_back(0.0f);
+        ys.push_back(0.0f);
+        radii.push_back(0.0f);
+        owners.push_back(0);
+        pinIds.push_back(-1);
+        updated.push_back(0);
+        slotOf.emplace(pinId, slot);
+    }
+    bool moved = pinIds[slot] != pinId || xs[slot] != x || ys[slot] != y || radii[slot] != radius;
+    xs[slot] = x;
+    ys[slot] = y;
+    radii[slot] = radius;
+    owners[slot] = owner;
+    pinIds[slot] = pinId;
+    updated[slot] = update;
+    if (moved)
+        grid.Update(slot, GridRect{ x - radius, y - radius, x + radius, y + radius });
+}
+
+void PinGeometry::EndUpdate()
+{
+    for (int slot = 0; slot < (int)pinIds.size(); slot++) {
+        if (pinIds[slot] < 0 || updated[slot] == update)
+            continue;
+        slotOf.erase(pinIds[slot]);
+        grid.Remove(slot);
+        pinIds[slot] = -1;
+        freeSlots.push_back(slot);
+    }
+}
+
+int PinGeometry::HitTest(float x, float y) const
+{
+    candidates.clear();
+    grid.QueryPoint(x, y, candidates);
+    int best = -1;
+    float bestDistance = 0.0f;
+    for (int slot : candidates) {
+        float dx = xs[slot] - x;
+        float dy = ys[slot] - y;
+        float distance = dx * dx + dy * dy;
+        if (distance <= radii[slot] * radii[slot] && (best < 0 || distance < bestDistance)) {
+            best = slot;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+int StringTable::Intern(const std::string& s)
+{
+    auto it = indices.find(s);
+    if (it != indices.end())
+        return it->second;
+    int index = (int)strings.size();
+    strings.push_back(s);
+    indices.emplace(s, index);
+    return index;
+}
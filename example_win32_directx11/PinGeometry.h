@@ -0,0 +1,57 @@
+// Pin data laid out for the canvas' per-frame queries.
+//
+// Hit testing only needs to know where pins are, so their positions and radii are kept in
+// parallel arrays (structure of arrays), one slot per pin, and a SpatialGrid over the slots
+// narrows a query down to the few pins near the mouse. Pins are updated in place each frame;
+// only those that moved to other grid cells cost more than a lookup.
+//
+// The strings pins refer to (labels, the id of the owning node) live in a StringTable, a cold
+// side table; pins only store indices into it, so comparing owners is an integer compare and
+// pin records stay small.
+
+#pragma once
+
+#include "SpatialGrid.h"
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class PinGeometry {
+public:
+    // Set every pin that still exists between these two calls; EndUpdate() drops the others
+    void BeginUpdate();
+    void Set(int pinId, float x, float y, float radius, int owner);
+    void EndUpdate();
+
+    int Size() const { return (int)slotOf.size(); }
+    int PinId(int slot) const { return pinIds[slot]; }
+    int Owner(int slot) const { return owners[slot]; }
+
+    // Slot of the pin nearest (x, y) among those whose circle contains it, or -1
+    int HitTest(float x, float y) const;
+
+private:
+    std::vector<float> xs;
+    std::vector<float> ys;
+    std::vector<float> radii;
+    std::vector<int> owners;
+    std::vector<int> pinIds;            // -1 for a free slot
+    std::vector<unsigned int> updated;  // Update in which the slot was last Set()
+    std::vector<int> freeSlots;
+    std::unordered_map<int, int> slotOf;
+    unsigned int update = 0;
+    SpatialGrid grid{ 64.0f };          // Over slots
+    mutable std::vector<int> candidates;
+};
+
+// Equal strings get the same index, valid for the lifetime of the table
+class StringTable {
+public:
+    int Intern(const std::string& s);
+    const std::string& Get(int index) const { return strings[index]; }
+
+private:
+    std::deque<std::string> strings;    // Never moves its elements, so Get() references stay valid
+    std::unordered_map<std::string, int> indices;
+};
@@ -0,0 +1,97 @@
+// Bump-pointer scratch memory. See ScratchArena.h
+
+#include "ScratchArena.h"
+#include "BufferPool.h"
+#include <string.h>
+
+static const size_t BlockHeaderSize = 64;   // Keeps block data 64-byte aligned
+
+struct ScratchBlock {
+    ScratchBlock* next;
+    size_t size;    // Usable bytes
+    size_t used;
+
+    unsigned char* Data() { return (unsigned char*)this + BlockHeaderSize; }
+};
+static_assert(sizeof(ScratchBlock) <= BlockHeaderSize, "block header must fit in front of the data");
+
+static size_t AlignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+ScratchArena::ScratchArena(size_t size)
+    : blockSize(size)
+{
+}
+
+ScratchArena::~ScratchArena()
+{
+    while (head) {
+        ScratchBlock* next = head->next;
+        PoolFree(head);
+        head = next;
+    }
+}
+
+ScratchArena& ScratchArena::ForThread()
+{
+    static thread_local ScratchArena arena;
+    return arena;
+}
+
+void* ScratchArena::Allocate(size_t bytes, size_t alignment)
+{
+    for (;;) {
+        if (current) {
+            size_t offset = AlignUp(current->used, alignment);
+            if (offset + bytes <= current->size) {
+                current->used = offset + bytes;
+                return current->Data() + offset;
+            }
+        }
+
+        // Move on to the next block kept from an earlier evaluation, or insert a new one
+        ScratchBlock* next = current ? current->next : head;
+        if (next && bytes + alignment <= next->size + BlockHeaderSize) {
+            next->used = 0;
+            current = next;
+            continue;
+        }
+        size_t size = bytes + alignment > blockSize ? AlignUp(bytes + alignment, 4096) : blockSize;
+        ScratchBlock* block = (ScratchBlock*)PoolAlloc(BlockHeaderSize + size);
+        if (!block)
+            return nullptr;
+        block->size = size;
+        block->used = 0;
+        block->next = next;
+        if (current)
+            current->next = block;
+        else
+            head = block;
+        current = block;
+        reserved += size;
+    }
+}
+
+ScratchArena::Marker ScratchArena::Mark() const
+{
+    return { current, current ? current->used : 0 };
+}
+
+void ScratchArena::Reset(const Marker& marker)
+{
+#ifdef SCRATCH_ARENA_POISON
+    if (current) {
+        for (ScratchBlock* b = marker.block ? marker.block : head;; b = b->next) {
+            size_t from = b == marker.block ? marker.used : 0;
+            memset(b->Data() + from, 0xDD, b->used - from);
+            if (b == current)
+                break;
+        }
+    }
+#endif
+    current = marker.block;
+    if (current)
+        current->used = marker.used;
+}
@@ -0,0 +1,65 @@
+// Bump-pointer scratch memory for the temporaries of one evaluation.
+//
+// Kernels need short-lived buffers: filter rows, hash tables, coefficient tables, histogram
+// bins. Each thread has its own arena; allocating is a pointer bump and everything allocated
+// inside a ScratchScope is released at once when the scope ends, in O(1). The blocks behind the
+// arena stay with the thread and are reused by the next evaluation, so temporaries never reach
+// malloc/free after the first run. Blocks come from the buffer pool.
+//
+// Debug builds (or SCRATCH_ARENA_POISON) fill released memory with 0xDD, so a pointer kept past
+// the end of its scope reads garbage instead of silently working.
+
+#pragma once
+
+#include <cstddef>
+
+#if defined(_DEBUG) && !defined(SCRATCH_ARENA_POISON)
+#define SCRATCH_ARENA_POISON
+#endif
+
+struct ScratchBlock;
+
+class ScratchArena {
+public:
+    explicit ScratchArena(size_t blockSize = 1 << 20);
+    ~ScratchArena();
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    // The calling thread's arena
+    static ScratchArena& ForThread();
+
+    // Uninitialized memory, valid until the enclosing scope resets the arena
+    void* Allocate(size_t bytes, size_t alignment = 64);
+    template <class T> T* AllocateArray(size_t count) {
+        return (T*)Allocate(count * sizeof(T), alignof(T) > 64 ? alignof(T) : 64);
+    }
+
+    struct Marker {
+        ScratchBlock* block;
+        size_t used;
+    };
+    Marker Mark() const;
+    void Reset(const Marker& marker);   // Release everything allocated since Mark()
+
+    size_t BytesReserved() const { return reserved; }
+
+private:
+    ScratchBlock* head = nullptr;
+    ScratchBlock* current = nullptr;    // nullptr: nothing allocated yet
+    size_t blockSize;
+    size_t reserved = 0;
+};
+
+// Releases the thread's scratch allocations made during its lifetime
+class ScratchScope {
+public:
+    explicit ScratchScope(ScratchArena& a = ScratchArena::ForThread()) : arena(a), marker(a.Mark()) {}
+    ~ScratchScope() { arena.Reset(marker); }
+    ScratchScope(const ScratchScope&) = delete;
+    ScratchScope& operator=(const ScratchScope&) = delete;
+
+private:
+    ScratchArena& arena;
+    ScratchArena::Marker marker;
+};
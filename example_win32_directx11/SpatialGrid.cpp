@@ -0,0 +1,113 @@
+// Uniform grid over canvas rectangles. See SpatialGrid.h
+
+#include "SpatialGrid.h"
+#include <algorithm>
+#include <cmath>
+
+SpatialGrid::CellRange SpatialGrid::CellsOf(const GridRect& rect) const
+{
+    CellRange range;
+    range.x0 = (int)std::floor(rect.x0 / cellSize);
+    range.y0 = (int)std::floor(rect.y0 / cellSize);
+    range.x1 = (int)std::floor(rect.x1 / cellSize);
+    range.y1 = (int)std::floor(rect.y1 / cellSize);
+    return range;
+}
+
+void SpatialGrid::Link(int id, const CellRange& range)
+{
+    for (int cy = range.y0; cy <= range.y1; cy++)
+        for (int cx = range.x0; cx <= range.x1; cx++)
+            cells[CellKey(cx, cy)].push_back(id);
+}
+
+void SpatialGrid::Unlink(int id, const CellRange& range)
+{
+    for (int cy = range.y0; cy <= range.y1; cy++) {
+        for (int cx = range.x0; cx <= range.x1; cx++) {
+            auto cell = cells.find(CellKey(cx, cy));
+            if (cell == cells.end())
+                continue;
+            std::vector<int>& ids = cell->second;
+            auto it = std::find(ids.begin(), ids.end(), id);
+            if (it != ids.end()) {
+                *it = ids.back();
+                ids.pop_back();
+            }
+            if (ids.empty())
+                cells.erase(cell);
+        }
+    }
+}
+
+void SpatialGrid::Update(int id, const GridRect& rect)
+{
+    CellRange range = CellsOf(rect);
+    auto it = items.find(id);
+    if (it == items.end()) {
+        items.emplace(id, Item{ rect, range });
+        Link(id, range);
+        return;
+    }
+    Item& item = it->second;
+    item.rect = rect;
+    const CellRange& old = item.cells;
+    if (old.x0 == range.x0 && old.y0 == range.y0 && old.x1 == range.x1 && old.y1 == range.y1)
+        return;     // Moved within its cells
+
+    // Only the cells it left and the cells it entered change
+    for (int cy = old.y0; cy <= old.y1; cy++) {
+        for (int cx = old.x0; cx <= old.x1; cx++) {
+            if (cx < range.x0 || cx > range.x1 || cy < range.y0 || cy > range.y1)
+                Unlink(id, CellRange{ cx, cy, cx, cy });
+        }
+    }
+    for (int cy = range.y0; cy <= range.y1; cy++) {
+        for (int cx = range.x0; cx <= range.x1; cx++) {
+            if (cx < old.x0 || cx > old.x1 || cy < old.y0 || cy > old.y1)
+                cells[CellKey(cx, cy)].push_back(id);
+        }
+    }
+    item.cells = range;
+}
+
+void SpatialGrid::Remove(int id)
+{
+    auto it = items.find(id);
+    if (it == items.end())
+        return;
+    Unlink(id, it->second.cells);
+    items.erase(it);
+}
+
+void SpatialGrid::QueryPoint(float x, float y, std::vector<int>& out) const
+{
+    auto cell = cells.find(CellKey((int)std::floor(x / cellSize), (int)std::floor(y / cellSize)));
+    if (cell == cells.end())
+        return;
+    GridRect point = { x, y, x, y };
+    for (int id : cell->second) {
+        if (Overlaps(items.at(id).rect, point))
+            out.push_back(id);
+    }
+}
+
+void SpatialGrid::QueryRect(const GridRect& rect, std::vector<int>& out) const
+{
+    CellRange range = CellsOf(rect);
+    for (int cy = range.y0; cy <= range.y1; cy++) {
+        for (int cx = range.x0; cx <= range.x1; cx++) {
+            auto cell = cells.find(CellKey(cx, cy));
+            if (cell == cells.end())
+                continue;
+            for (int id : cell->second) {
+                const Item& item = items.at(id);
+                // An item spanning several queried cells is reported from the first of them only
+                if (std::max(item.cells.x0, range.x0) != cx || std::max(item.cells.y0, range.y0) != cy)
+                    continue;
+                if (Overlaps(item.rect, rect))
+                    out.push_back(id);
+            }
+        }
+    }
+}
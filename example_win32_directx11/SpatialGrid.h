@@ -0,0 +1,55 @@
+// Uniform grid over rectangles on the canvas, for "what is under this point" and "what is in
+// this rectangle" queries that cost the same whether the graph has ten items or ten thousand.
+//
+// Every item is listed in the cells its rectangle overlaps. A point query reads one cell; a
+// rectangle query reads the cells it covers. Items are keyed by an int the caller chooses and
+// updated in place: moving an item touches only the cells it leaves and enters, and updating
+// it with the rectangle it already has costs a hash lookup, so callers can simply update every
+// item every frame.
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+struct GridRect {
+    float x0, y0;   // Inclusive
+    float x1, y1;   // Inclusive
+};
+
+class SpatialGrid {
+public:
+    explicit SpatialGrid(float cellSize) : cellSize(cellSize) {}
+
+    // Insert an item or move it to 'rect'
+    void Update(int id, const GridRect& rect);
+    void Remove(int id);
+    bool Contains(int id) const { return items.count(id) != 0; }
+    const GridRect& Rect(int id) const { return items.at(id).rect; }
+    int Size() const { return (int)items.size(); }
+
+    // Ids of the items whose rectangle contains (x, y), appended to 'out' in no particular order
+    void QueryPoint(float x, float y, std::vector<int>& out) const;
+
+    // Ids of the items whose rectangle overlaps 'rect', each once, appended to 'out'
+    void QueryRect(const GridRect& rect, std::vector<int>& out) const;
+
+private:
+    struct CellRange {
+        int x0, y0, x1, y1;     // Inclusive
+    };
+    struct Item {
+        GridRect rect;
+        CellRange cells;
+    };
+
+    CellRange CellsOf(const GridRect& rect) const;
+    static long long CellKey(int cx, int cy) { return (long long)(((unsigned long long)(unsigned int)cx << 32) | (unsigned int)cy); }
+    static bool Overlaps(const GridRect& a, const GridRect& b) { return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1; }
+    void Link(int id, const CellRange& cells);
+    void Unlink(int id, const CellRange& cells);
+
+    float cellSize;
+    std::unordered_map<int, Item> items;
+    std::unordered_map<long long, std::vector<int>> cells;
+};
@@ -0,0 +1,192 @@
+// Coroutines that run on the thread pool.
+//
+// A node whose work is naturally asynchronous writes it as a coroutine returning Task<T>. It
+// co_awaits other Tasks for its sub-steps, ResumeOnPool() to move onto a worker, and
+// RunBlocking(fn) for calls that would hold a thread for a long time without computing (a modal
+// dialog, a slow device, a remote worker). Those run as a pool task of their own in the
+// caller's class, like everything else, so no thread is created per call; keep them rare, since
+// one worker waits with them.
+//
+// Tasks are lazy. A coroutine that awaits one starts it and continues when it finishes. The UI
+// thread calls Start() instead, checks IsReady() once a frame and takes the result with Get();
+// a Start()ed task wakes the UI when it finishes (UIWake.h). An owner that goes away before the
+// task finishes Detach()es it instead of waiting: the coroutine then frees itself when done, so
+// it must not refer to its owner (take a shared state instead of 'this').
+// Every hop onto the pool keeps the priority class of the thread that made it (ThreadPool.h).
+//
+// Failures are reported through the result, as everywhere else: an exception escaping a
+// coroutine terminates the process.
+
+#pragma once
+
+#include "ThreadPool.h"
+#include "UIWake.h"
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+template <class T> class Task;
+
+struct TaskPromiseBase {
+    enum { Finished = 1, Detached = 2 };
+
+    std::coroutine_handle<> continuation;   // The coroutine awaiting this one, if any
+    std::atomic<int> state{ 0 };            // Set instead when nobody awaits it: Start()ed tasks. Whichever
+                                            // of Finished and Detached comes second frees the coroutine.
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <class Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept {
+            TaskPromiseBase& promise = self.promise();
+            if (promise.continuation)
+                return promise.continuation;
+            // The owner may destroy us from here on
+            if (promise.state.fetch_or(Finished, std::memory_order_acq_rel) & Detached) {
+                self.destroy();
+                return std::noop_coroutine();
+            }
+            WakeUI();
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() noexcept { std::terminate(); }
+};
+
+template <class T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+    Task<T> get_return_object();
+    void return_value(T result) { value = std::move(result); }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+};
+
+template <class T>
+class Task {
+public:
+    typedef TaskPromise<T> promise_type;
+
+    Task() = default;
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)), started(std::exchange(other.started, false)) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            handle = std::exchange(other.handle, nullptr);
+            started = std::exchange(other.started, false);
+        }
+        return *this;
+    }
+    ~Task() { Reset(); }
+
+    // Holds a coroutine whose result has not been taken yet
+    bool Valid() const { return (bool)handle; }
+
+    // Run the coroutine on the pool, in the calling thread's priority class
+    void Start() {
+        std::coroutine_handle<> coroutine = handle;
+        started = true;
+        RunDetached([coroutine]() { coroutine.resume(); });
+    }
+
+    bool IsReady() const { return handle && (handle.promise().state.load(std::memory_order_acquire) & TaskPromiseBase::Finished); }
+
+    // Give up on the result without waiting: a started coroutine runs on and frees itself, its
+    // result included. Leaves the Task empty.
+    void Detach() {
+        if (!handle)
+            return;
+        if (!started || (handle.promise().state.fetch_or(TaskPromiseBase::Detached, std::memory_order_acq_rel) & TaskPromiseBase::Finished))
+            handle.destroy();
+        handle = nullptr;
+        started = false;
+    }
+
+    // Only for teardown: the UI polls IsReady() instead
+    void Wait() const {
+        while (!IsReady())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // The result of a Start()ed task, waiting for it if needed. Leaves the Task empty.
+    T Get() {
+        Wait();
+        Task done(std::move(*this));    // Frees the coroutine once the result is out
+        if constexpr (!std::is_void_v<T>)
+            return std::move(*done.handle.promise().value);
+    }
+
+    // co_await from another coroutine: runs it, then continues the awaiting one
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    T await_resume() {
+        if constexpr (!std::is_void_v<T>)
+            return std::move(*handle.promise().value);
+    }
+
+private:
+    void Reset() {
+        if (!handle)
+            return;
+        if (started)
+            Wait();
+        handle.destroy();
+        handle = nullptr;
+    }
+
+    std::coroutine_handle<promise_type> handle;
+    bool started = false;
+};
+
+template <class T>
+Task<T> TaskPromise<T>::get_return_object() { return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this)); }
+
+inline Task<void> TaskPromise<void>::get_return_object() { return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this)); }
+
+// co_await ResumeOnPool(): continue as a task on the pool
+struct ResumeOnPool {
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> coroutine) const { RunDetached([coroutine]() { coroutine.resume(); }); }
+    void await_resume() const noexcept {}
+};
+
+// co_await RunBlocking(fn): call fn() as a pool task and continue with its result. For calls that
+// wait rather than compute.
+template <class Fn>
+auto RunBlocking(Fn fn) {
+    typedef std::invoke_result_t<Fn> Result;
+    static_assert(!std::is_void_v<Result>, "RunBlocking returns what fn returns");
+
+    struct Awaiter {
+        Fn fn;
+        std::optional<Result> result;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> coroutine) {
+            RunDetached([this, coroutine]() {
+                result = fn();
+                coroutine.resume();
+            });
+        }
+        Result await_resume() { return std::move(*result); }
+    };
+    return Awaiter{ std::move(fn), std::nullopt };
+}
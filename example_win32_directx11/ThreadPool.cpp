@@ -0,0 +1,487 @@
+// Work-stealing thread pool. See ThreadPool.h
+
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+struct ThreadPoolTask {
+    std::function<void()> fn;
+    TaskGroup* group = nullptr;
+    TaskPriority priority = TaskPriority_Background;
+    std::chrono::steady_clock::time_point queuedAt;
+};
+
+// Tasks are few and coarse (a band, a chunk, a tile), so a lock per deque costs nothing next to
+// the work and keeps stealing simple
+struct WorkQueue {
+    std::mutex mutex;
+    std::deque<ThreadPoolTask> tasks;
+};
+
+// Tasks from threads outside the pool, one FIFO per class
+struct SharedQueue {
+    std::mutex mutex;
+    std::deque<ThreadPoolTask> tasks[TaskPriority_Count];
+};
+
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads);
+
+    void Push(ThreadPoolTask task);
+
+    // Run the most urgent queued task, if there is any: the caller's own newest, a shared one or
+    // one stolen from another worker, whichever is in the most urgent class after aging. Ties go
+    // to the caller's own task, then to the shared queue.
+    bool RunOne();
+
+    // Sleep until there may be work, or until 'done' holds
+    template <class Pred> void Sleep(Pred done) {
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [&]() { return queued.load() > 0 || done(); });
+    }
+
+    // Wake every sleeper, so waiters recheck their groups
+    void NotifyAll() {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wake.notify_all();
+    }
+
+    int Size() const { return (int)queues.size() + 1; }
+
+private:
+    void WorkerMain(int index);
+    int PeekShared(std::chrono::steady_clock::time_point now);
+    bool PopShared(int mustBeat, ThreadPoolTask& task);
+    bool PopNewest(WorkQueue& queue, int& cls, std::chrono::steady_clock::time_point now, bool peek, ThreadPoolTask& task);
+    bool PopMostUrgent(WorkQueue& queue, int& cls, std::chrono::steady_clock::time_point now, bool peek, ThreadPoolTask& task);
+
+    // queues[i - 1] belongs to worker i. Threads outside the pool push to 'shared'.
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    SharedQueue shared;
+    std::atomic<int> queued{ 0 };
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+};
+
+// Class a task counts as after waiting since it was queued
+static int EffectiveClass(const ThreadPoolTask& task, std::chrono::steady_clock::time_point now)
+{
+    long long waitedMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - task.queuedAt).count();
+    return std::max(0, (int)task.priority - (int)(waitedMs / TaskAgingIntervalMs));
+}
+
+static thread_local int t_WorkerIndex = 0;      // 0 outside the pool
+static thread_local TaskPriority t_Priority = TaskPriority_Background;
+static std::atomic<int> g_RequestedThreads{ 0 };
+
+ThreadPool::ThreadPool(int threads)
+{
+    // The waiting caller is one of the threads, so spawn one fewer
+    int workers = std::max(1, threads - 1);
+    for (int i = 0; i < workers; i++)
+        queues.emplace_back(new WorkQueue());
+    for (int i = 1; i <= workers; i++)
+        std::thread([this, i]() { WorkerMain(i); }).detach();
+}
+
+void ThreadPool::Push(ThreadPoolTask task)
+{
+    task.priority = t_Priority;
+    task.queuedAt = std::chrono::steady_clock::now();
+    if (t_WorkerIndex > 0) {
+        WorkQueue& queue = *queues[t_WorkerIndex - 1];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    else {
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        shared.tasks[task.priority].push_back(std::move(task));
+    }
+    queued++;
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    wake.notify_one();
+}
+
+// The newest task of 'queue' and its class: what its owner runs next. With 'peek' only the
+// class is returned.
+bool ThreadPool::PopNewest(WorkQueue& queue, int& cls, std::chrono::steady_clock::time_point now, bool peek, ThreadPoolTask& task)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+    cls = EffectiveClass(queue.tasks.back(), now);
+    if (!peek) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+    }
+    return true;
+}
+
+// The task of 'queue' in the most urgent class after aging, the oldest of them: what a thief
+// takes. Deques hold a few coarse tasks each, so scanning them is cheap.
+bool ThreadPool::PopMostUrgent(WorkQueue& queue, int& cls, std::chrono::steady_clock::time_point now, bool peek, ThreadPoolTask& task)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    int best = -1;
+    int bestClass = TaskPriority_Count;
+    for (int i = 0; i < (int)queue.tasks.size() && bestClass > 0; i++) {
+        int effective = EffectiveClass(queue.tasks[i], now);
+        if (effective < bestClass) {
+            best = i;
+            bestClass = effective;
+        }
+    }
+    if (best < 0)
+        return false;
+    cls = bestClass;
+    if (!peek) {
+        task = std::move(queue.tasks[best]);
+        queue.tasks.erase(queue.tasks.begin() + best);
+    }
+    return true;
+}
+
+// Class of the most urgent shared task after aging, TaskPriority_Count if there is none
+int ThreadPool::PeekShared(std::chrono::steady_clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    int bestClass = TaskPriority_Count;
+    for (int c = 0; c < TaskPriority_Count; c++) {
+        if (!shared.tasks[c].empty())
+            bestClass = std::min(bestClass, EffectiveClass(shared.tasks[c].front(), now));
+    }
+    return bestClass;
+}
+
+// Pop the shared task of the most urgent class after aging, if it is more urgent than
+// 'mustBeat'. Within a class the oldest goes first, and so does the longer waiting of two
+// tasks that aged into the same class.
+bool ThreadPool::PopShared(int mustBeat, ThreadPoolTask& task)
+{
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    int best = -1;
+    int bestClass = mustBeat;
+    for (int c = 0; c < TaskPriority_Count; c++) {
+        if (shared.tasks[c].empty())
+            continue;
+        const ThreadPoolTask& head = shared.tasks[c].front();
+        int effective = EffectiveClass(head, now);
+        if (effective < bestClass || (best >= 0 && effective == bestClass && head.queuedAt < shared.tasks[best].front().queuedAt)) {
+            best = c;
+            bestClass = effective;
+        }
+    }
+    if (best < 0)
+        return false;
+    task = std::move(shared.tasks[best].front());
+    shared.tasks[best].pop_front();
+    return true;
+}
+
+bool ThreadPool::RunOne()
+{
+    ThreadPoolTask task;
+    int self = t_WorkerIndex;
+    WorkQueue* own = self > 0 ? queues[self - 1].get() : nullptr;
+
+    // Look at every source, then take from the best one. Another thread may take that task
+    // first, in which case look again.
+    bool found = false;
+    while (!found) {
+        auto now = std::chrono::steady_clock::now();
+
+        // The caller's own newest task is the one spawned last by the work it is in the middle of
+        int ownClass = TaskPriority_Count;
+        if (own)
+            PopNewest(*own, ownClass, now, true, task);
+        int sharedClass = PeekShared(now);
+
+        // Tasks a worker spawned sit in its deque, so urgent tiles split off by a worker are
+        // found here, possibly behind older, less urgent ones. The caller's own deque is
+        // included: its newest task need not be its most urgent.
+        int victim = -1;
+        int victimClass = TaskPriority_Count;
+        for (int i = 0; i < (int)queues.size() && victimClass > 0; i++) {
+            int index = (std::max(self, 1) + i) % (int)queues.size();
+            int cls = TaskPriority_Count;
+            if (PopMostUrgent(*queues[index], cls, now, true, task) && cls < victimClass) {
+                victim = index;
+                victimClass = cls;
+            }
+        }
+
+        int bestClass = std::min(ownClass, std::min(sharedClass, victimClass));
+        if (bestClass == TaskPriority_Count)
+            return false;
+        int cls = TaskPriority_Count;
+        if (ownClass == bestClass)
+            found = PopNewest(*own, cls, now, false, task);
+        else if (sharedClass == bestClass)
+            found = PopShared(TaskPriority_Count, task);
+        else
+            found = PopMostUrgent(*queues[victim], cls, now, false, task);
+    }
+    queued--;
+
+    TaskPriority outer = t_Priority;
+    t_Priority = task.priority;
+    task.fn();
+    t_Priority = outer;
+    TaskGroup* group = task.group;
+    task.fn = nullptr;      // Release captures before the group can be seen as done
+    if (--group->pending == 0)
+        NotifyAll();        // 'group' may be gone from here on
+    return true;
+}
+
+void ThreadPool::WorkerMain(int index)
+{
+    t_WorkerIndex = index;
+    for (;;) {
+        if (!RunOne())
+            Sleep([]() { return false; });
+    }
+}
+
+// Never destroyed: workers run until the process exits, like the other process-wide singletons
+static ThreadPool& GetPool()
+{
+    static ThreadPool* pool = new ThreadPool(g_RequestedThreads.load() > 0 ? g_RequestedThreads.load() : AvailableCpuCount());
+    return *pool;
+}
+
+#ifndef _WIN32
+// CPUs allowed by the cgroup CPU quota (v2, then v1), or 0 without a quota
+static int CgroupCpuLimit()
+{
+    long long quota = -1, period = 0;
+    if (FILE* f = fopen("/sys/fs/cgroup/cpu.max", "r")) {
+        char max[32] = {};
+        if (fscanf(f, "%31s %lld", max, &period) == 2 && max[0] != 'm')
+            quota = atoll(max);
+        fclose(f);
+    }
+    else {
+        if (FILE* q = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r")) {
+            if (fscanf(q, "%lld", &quota) != 1)
+                quota = -1;
+            fclose(q);
+        }
+        if (FILE* p = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r")) {
+            if (fscanf(p, "%lld", &period) != 1)
+                period = 0;
+            fclose(p);
+        }
+    }
+    if (quota <= 0 || period <= 0)
+        return 0;
+    return (int)std::max(1LL, (quota + period - 1) / period);
+}
+#endif
+
+int AvailableCpuCount()
+{
+    int count = 0;
+#ifdef _WIN32
+    DWORD_PTR processMask = 0, systemMask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+        for (; processMask; processMask &= processMask - 1)
+            count++;
+    }
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        count = CPU_COUNT(&set);
+    int quota = CgroupCpuLimit();
+    if (quota > 0 && (count == 0 || quota < count))
+        count = quota;
+#endif
+    if (count <= 0)
+        count = (int)std::thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+}
+
+void SetThreadPoolSize(int threads)
+{
+    g_RequestedThreads = threads;
+}
+
+int GetThreadPoolSize()
+{
+    return GetPool().Size();
+}
+
+TaskPriority CurrentTaskPriority()
+{
+    return t_Priority;
+}
+
+ScopedTaskPriority::ScopedTaskPriority(TaskPriority priority)
+    : previous(t_Priority)
+{
+    t_Priority = priority;
+}
+
+ScopedTaskPriority::~ScopedTaskPriority()
+{
+    t_Priority = previous;
+}
+
+void TaskGroup::Run(std::function<void()> task)
+{
+    pending++;
+    ThreadPoolTask t;
+    t.fn = std::move(task);
+    t.group = this;
+    GetPool().Push(std::move(t));
+}
+
+void TaskGroup::Wait()
+{
+    ThreadPool& pool = GetPool();
+    while (pending.load() > 0) {
+        if (!pool.RunOne())
+            pool.Sleep([this]() { return pending.load() == 0; });
+    }
+}
+
+void RunDetached(std::function<void()> task)
+{
+    static TaskGroup* detached = new TaskGroup();   // Never waited for, so never destroyed
+    detached->Run(std::move(task));
+}
+
+void ParallelFor(int count, const std::function<void(int)>& fn, int maxParallelism)
+{
+    int tasks = maxParallelism > 0 ? maxParallelism : GetThreadPoolSize();
+    tasks = std::min(tasks, count);
+    if (tasks <= 1) {
+        for (int i = 0; i < count; i++)
+            fn(i);
+        return;
+    }
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int i = next++; i < count; i = next++)
+            fn(i);
+    };
+    TaskGroup group;
+    for (int t = 1; t < tasks; t++)
+        group.Run(worker);
+    worker();
+    group.Wait();
+}
+
+void ParallelForTiles(int width, int height, int tileWidth, int tileHeight, const std::function<void(const TileRect&)>& fn,
+                      TileOrder order)
+{
+    if (width <= 0 || height <= 0)
+        return;
+    int columns = (width + tileWidth - 1) / tileWidth;
+    int rows = (height + tileHeight - 1) / tileHeight;
+    std::vector<int> sequence;
+    if (order == TileOrder_CentreOut) {
+        // Squared distance between tile centres and the area's centre, in doubled tile units so
+        // it stays integral
+        auto distance = [&](int i) {
+            long long dx = 2LL * (i % columns) + 1 - columns;
+            long long dy = 2LL * (i / columns) + 1 - rows;
+            return dx * dx * tileWidth * tileWidth + dy * dy * tileHeight * tileHeight;
+        };
+        sequence.resize((size_t)columns * rows);
+        for (int i = 0; i < (int)sequence.size(); i++)
+            sequence[i] = i;
+        std::stable_sort(sequence.begin(), sequence.end(), [&](int a, int b) { return distance(a) < distance(b); });
+    }
+    ParallelFor(columns * rows, [&](int n) {
+        int i = sequence.empty() ? n : sequence[n];
+        TileRect tile;
+        tile.x0 = (i % columns) * tileWidth;
+        tile.y0 = (i / columns) * tileHeight;
+        tile.x1 = std::min(tile.x0 + tileWidth, width);
+        tile.y1 = std::min(tile.y0 + tileHeight, height);
+        fn(tile);
+    });
+}
+
+bool CheckTaskPriorities()
+{
+    const int BatchTasks = 400;
+    const int Tiles = 64;
+    const auto TaskTime = std::chrono::milliseconds(2);
+    int threads = GetThreadPoolSize();
+
+    // Every worker up and idle, as in a running session
+    ParallelFor(threads * 4, [&](int) { std::this_thread::sleep_for(TaskTime); });
+
+    // An export job queues its work from a worker, then a slider is dragged and the preview
+    // splits into tiles on that same worker: the tiles land in its deque behind the backlog
+    std::atomic<int> batchDone(0);
+    std::mutex mutex;
+    std::vector<std::thread::id> tileThreads;
+    int batchDuringTiles = 0;
+    double tileSeconds = 0.0;
+    std::atomic<bool> jobDone(false);
+    TaskGroup batch;
+    TaskGroup job;
+    {
+        ScopedTaskPriority scope(TaskPriority_Batch);
+        job.Run([&]() {
+            for (int i = 0; i < BatchTasks; i++) {
+                batch.Run([&]() {
+                    std::this_thread::sleep_for(TaskTime);
+                    batchDone++;
+                });
+            }
+            ScopedTaskPriority interactive(TaskPriority_Interactive);
+            auto start = std::chrono::steady_clock::now();
+            int batchBefore = batchDone;
+            ParallelFor(Tiles, [&](int) {
+                std::this_thread::sleep_for(TaskTime);
+                std::lock_guard<std::mutex> lock(mutex);
+                if (std::find(tileThreads.begin(), tileThreads.end(), std::this_thread::get_id()) == tileThreads.end())
+                    tileThreads.push_back(std::this_thread::get_id());
+            });
+            batchDuringTiles = batchDone - batchBefore;
+            tileSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            jobDone = true;
+        });
+    }
+    // Not job.Wait(): this thread would pick up the job itself and queue from outside the pool
+    while (!jobDone)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    job.Wait();
+    batch.Wait();
+
+    // Batch tasks already running when the tiles were queued finish first, at most a couple per
+    // thread; anything beyond that ran instead of a tile
+    bool spread = threads == 1 || (int)tileThreads.size() > 1;
+    bool first = batchDuringTiles <= 2 * threads;
+    printf("%d threads: %d interactive tiles ran on %d threads in %.0f ms, %d of %d batch tasks finished meanwhile\n",
+           threads, Tiles, (int)tileThreads.size(), tileSeconds * 1000.0, batchDuringTiles, BatchTasks);
+    printf("%s\n", spread && first ? "OK" : "FAILED: interactive work waited behind batch work");
+    return spread && first;
+}
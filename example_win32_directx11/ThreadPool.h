@@ -0,0 +1,104 @@
+// The process-wide pool of worker threads that all parallel work runs on.
+//
+// Each worker has its own deque of tasks. A worker pushes the tasks it spawns onto its own deque
+// and pops from the same end, so nested work stays hot in its cache; when another worker has
+// more urgent work it steals that. Tasks spawned by other threads (the UI, load and save jobs)
+// go to a shared queue that workers take from as well.
+//
+// A thread waiting for a TaskGroup runs queued tasks until the group is done instead of
+// blocking. Nested parallelism therefore costs no extra threads: a parallel node whose tiles
+// are parallel too still runs on the same fixed set of workers, and a wait never deadlocks.
+//
+// The pool starts on first use with one thread per CPU the process may use (its affinity mask
+// and, on Linux, its cgroup CPU quota), the waiting caller counting as one of them.
+//
+// Work has a priority class. A task inherits the class of the thread that runs it into the pool
+// and passes it on to the tasks it spawns, so tagging a job once (ScopedTaskPriority) tags every
+// tile it splits into. Free workers take the most urgent task first, wherever it is queued.
+// Waiting lifts a task one class every TaskAgingInterval, so a steady stream of interactive
+// work never starves a save.
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+// Threads the pool runs work on, callers included. Only takes effect before the first parallel
+// call; 0 picks the default.
+void SetThreadPoolSize(int threads);
+int GetThreadPoolSize();
+
+// CPUs available to this process: affinity mask and cgroup quota taken into account
+int AvailableCpuCount();
+
+enum TaskPriority {
+    TaskPriority_Interactive = 0,   // A control is being dragged: the preview must follow it
+    TaskPriority_Visible,           // Results on screen
+    TaskPriority_Background,        // Off-screen results, loads; the default
+    TaskPriority_Batch,             // Exports nobody is watching
+    TaskPriority_Count
+};
+
+// How long a queued task waits before it is treated as one class more urgent
+static const int TaskAgingIntervalMs = 100;
+
+// Class of the work the calling thread is doing, which the tasks it spawns inherit
+TaskPriority CurrentTaskPriority();
+
+// Run the calling thread's work, and everything it spawns, in another class for a scope
+class ScopedTaskPriority {
+public:
+    explicit ScopedTaskPriority(TaskPriority priority);
+    ~ScopedTaskPriority();
+    ScopedTaskPriority(const ScopedTaskPriority&) = delete;
+    ScopedTaskPriority& operator=(const ScopedTaskPriority&) = delete;
+
+private:
+    TaskPriority previous;
+};
+
+// A set of tasks that can be waited for together
+class TaskGroup {
+public:
+    TaskGroup() = default;
+    ~TaskGroup() { Wait(); }
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void Run(std::function<void()> task);
+
+    // Return once every task run in this group has finished, running queued tasks meanwhile
+    void Wait();
+
+private:
+    friend class ThreadPool;
+    std::atomic<int> pending{ 0 };
+};
+
+// Queue a task nobody waits for, in the calling thread's priority class. Coroutines (Task.h)
+// resume through this.
+void RunDetached(std::function<void()> task);
+
+// Run fn(i) for i in [0, count). Indices are handed out one at a time to at most
+// 'maxParallelism' tasks (0: the pool size), so uneven items balance out.
+void ParallelFor(int count, const std::function<void(int)>& fn, int maxParallelism = 0);
+
+struct TileRect {
+    int x0, y0;     // Inclusive
+    int x1, y1;     // Exclusive
+};
+
+enum TileOrder {
+    TileOrder_RowMajor,
+    TileOrder_CentreOut,    // Tiles nearest the centre of the area first, where the eye goes
+};
+
+// Split a width x height area into tiles of at most tileWidth x tileHeight and run fn on each.
+// Tiles are handed out in 'order'.
+void ParallelForTiles(int width, int height, int tileWidth, int tileHeight, const std::function<void(const TileRect&)>& fn,
+                      TileOrder order = TileOrder_RowMajor);
+
+// Check that urgent work does not wait behind queued batch work: interactive tiles split off
+// inside a task, while hundreds of batch tasks are queued, must spread over the pool and run
+// before the batch backlog. Prints what it measured. For --check-scheduler.
+bool CheckTaskPriorities();
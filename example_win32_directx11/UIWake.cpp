@@ -0,0 +1,27 @@
+// Wakes the UI thread. See UIWake.h
+
+#include "UIWake.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+
+void* UIWakeEvent()
+{
+    static HANDLE event = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+    return event;
+}
+
+void WakeUI()
+{
+    SetEvent(UIWakeEvent());
+}
+#else
+// The main loop is Win32 only; elsewhere there is nobody to wake
+void WakeUI() {}
+#endif
@@ -0,0 +1,16 @@
+// Wakes the UI thread when background work has something for it.
+//
+// While nothing changes, the main loop blocks on window messages and on this signal instead of
+// drawing frames. Code that completes work the UI is waiting for (a load, a preview, a file that
+// changed on disk) calls WakeUI() once the result is visible to the UI thread, and the UI draws a
+// frame to pick it up. A wake with nothing to pick up costs one frame.
+
+#pragma once
+
+// Any thread
+void WakeUI();
+
+#ifdef _WIN32
+// Auto-reset event handle signalled by WakeUI(), for the main loop's MsgWaitForMultipleObjects
+void* UIWakeEvent();
+#endif
@@ -14,7 +14,16 @@
 #include <math.h>
 #include <string>
 #include <vector>
+#include <deque>
+#include <unordered_map>
 #include <memory>
+#include "BufferPool.h"
+#include "ScratchArena.h"
+#include "MemoryPlanner.h"
+// stb's decoded images and its temporaries come from the buffer pool too
+#define STBI_MALLOC(size) PoolAlloc(size)
+#define STBI_REALLOC(p, size) PoolRealloc(p, size)
+#define STBI_FREE(p) PoolFree(p)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
 #include "ImGuiFileDialog.h"
@@ -25,6 +34,20 @@
 #include <commdlg.h>
 #include <iostream>
 #include <d3dcompiler.h>
+#include <functional>
+#include <array>
+#include "ImageIO.h"
+#include "ImageSequence.h"
+#include "FileWatcher.h"
+#include "PinGeometry.h"
+#include "SpatialGrid.h"
+#include "MemoryGovernor.h"
+#include "ThreadPool.h"
+#include "Cancellation.h"
+#include "DoubleBuffer.h"
+#include "ParamChannel.h"
+#include "Task.h"
+#include "UIWake.h"
 //#pragma comment(lib, "d3dcompiler.lib")
 //#pragma comment(lib, "d3d11.lib")
 
@@ -58,22 +81,51 @@ int GetNextPinId() {
     return currentId++;
 }
 
+// Image passed along links: a texture nobody may write to once it is shared. Pins and nodes
+// hold it through reference-counted handles, so fanning an image out to any number of consumers
+// copies a pointer, never pixels, and the texture is released by whichever handle lets go of
+// it last. A producer that wants to change an image writes into one only it holds (see
+// ImageIsUnique) and otherwise publishes a new one: copy-on-write.
+struct ImageResource {
+    ID3D11ShaderResourceView* srv = nullptr;
+    int width = 0;
+    int height = 0;
+
+    ImageResource(ID3D11ShaderResourceView* srv, int width, int height) : srv(srv), width(width), height(height) {}
+    ~ImageResource() {
+        if (srv)
+            srv->Release();
+    }
+    ImageResource(const ImageResource&) = delete;
+    ImageResource& operator=(const ImageResource&) = delete;
+};
+typedef shared_ptr<const ImageResource> ImageHandle;
+
+// Take ownership of 'srv'. Null in, null out.
+ImageHandle MakeImageHandle(ID3D11ShaderResourceView* srv, int width, int height)
+{
+    if (!srv)
+        return nullptr;
+    return make_shared<ImageResource>(srv, width, height);
+}
+
+// True when 'image' is the only handle to the image, so writing to it can't be seen elsewhere.
+// UI thread only: handles are only ever copied there.
+bool ImageIsUnique(const ImageHandle& image)
+{
+    return image && image.use_count() == 1;
+}
+
 struct Pin {
     int id;
-    string label;
+    int label;          // Index into g_PinStrings
     ImVec2 Pos;
     bool isInput;
-    string ParentNodeId;
+    int ParentNode;     // Index of the owning node's NodeId in g_PinStrings
     float radius = 6.2f;
     bool IsInputNodePin = false;
     bool IsConnectedToMiddle = false;
-    ID3D11ShaderResourceView* imageSRV = nullptr;
-    
-
-    bool IsMouseOver(const ImVec2& mousePos) {
-        double distance = sqrt(pow(mousePos.x - Pos.x, 2) + pow(mousePos.y - Pos.y, 2));
-        return distance <= radius ;
-    }
+    ImageHandle image;
 };
 
 struct Link {
@@ -90,6 +142,17 @@ ImVec2 currentMousePos = ImVec2(0, 0);
 Link* activeLink = nullptr;
 vector<Link> links;
 vector<Pin> Pins;
+StringTable g_PinStrings;
+PinGeometry g_PinGeometry;     // Where the pins in Pins were drawn last frame
+SpatialGrid g_NodeGrid(128.0f);     // Where the node windows were drawn last frame, keyed by PinOwner()
+unordered_map<int, int> g_PinIndexById;     // Index in Pins of each pin id, rebuilt with g_PinGeometry
+
+// What the mouse is over, looked up in the grids once per frame
+struct CanvasHover {
+    int pinId = -1;
+    int nodeOwner = -1;     // PinOwner() of a node window under the mouse
+};
+CanvasHover g_CanvasHover;
 
 // Get Pin by ID
 Pin* GetPinById(int pinId) {
@@ -101,63 +164,96 @@ Pin* GetPinById(int pinId) {
     return nullptr;  // Return nullptr if pin with the given ID is not found
 }
 
-Pin* GetPinUnderMouse(vector<Pin>& pins) {
+// Called once per frame before the nodes draw. Hit tests against the canvas as it was drawn
+// last frame, which is what the user is pointing at.
+void UpdateCanvasHover() {
     ImVec2 mousePos = ImGui::GetIO().MousePos;
-    for (auto& pin : pins) {
-        if (pin.IsMouseOver(mousePos)) {
-            return &pin;
-        }
-    }
-    return nullptr;
-}
+    int hit = g_PinGeometry.HitTest(mousePos.x, mousePos.y);
+    g_CanvasHover.pinId = hit >= 0 ? g_PinGeometry.PinId(hit) : -1;
 
+    static vector<int> nodesHit;
+    nodesHit.clear();
+    g_NodeGrid.QueryPoint(mousePos.x, mousePos.y, nodesHit);
+    g_CanvasHover.nodeOwner = nodesHit.empty() ? -1 : nodesHit.front();
+}
 
-void DrawBezierCurve(ImDrawList* drawList, const ImVec2& start, const ImVec2& end, const ImVec2& control, ImU32 color, float thickness = 1.5f) {
-    const int segments = 30;
-    for (int i = 0; i < segments; ++i) {
-        float t0 = (float)i / (float)(segments - 1);
-        float t1 = (float)(i + 1) / (float)(segments - 1);
+// Get Pin by ID through g_PinIndexById. Nodes created or deleted since it was built may have
+// moved pins around in Pins; those are found by scanning.
+Pin* FindPin(int pinId) {
+    auto index = g_PinIndexById.find(pinId);
+    if (index != g_PinIndexById.end() && index->second < (int)Pins.size() && Pins[index->second].id == pinId) {
+        return &Pins[index->second];
+    }
+    return GetPinById(pinId);
+}
 
-        ImVec2 p0 = ImVec2(
-            start.x * (1 - t0) * (1 - t0) + control.x * 2 * (1 - t0) * t0 + end.x * t0 * t0,
-            start.y * (1 - t0) * (1 - t0) + control.y * 2 * (1 - t0) * t0 + end.y * t0 * t0
-        );
+Pin* GetPinUnderMouse() {
+    return g_CanvasHover.pinId >= 0 ? FindPin(g_CanvasHover.pinId) : nullptr;
+}
 
-        ImVec2 p1 = ImVec2(
-            start.x * (1 - t1) * (1 - t1) + control.x * 2 * (1 - t1) * t1 + end.x * t1 * t1,
-            start.y * (1 - t1) * (1 - t1) + control.y * 2 * (1 - t1) * t1 + end.y * t1 * t1
-        );
+// Called once all nodes have drawn, so the geometry matches what is on screen. Pins that did
+// not move cost a lookup.
+void UpdatePinGeometry() {
+    g_PinGeometry.BeginUpdate();
+    g_PinIndexById.clear();
+    for (int i = 0; i < (int)Pins.size(); i++) {
+        const Pin& pin = Pins[i];
+        g_PinGeometry.Set(pin.id, pin.Pos.x, pin.Pos.y, pin.radius, pin.ParentNode);
+        g_PinIndexById[pin.id] = i;
+    }
+    g_PinGeometry.EndUpdate();
+}
 
-        drawList->AddLine(p0, p1, color, thickness);
+// Get the output pin linked into the given input pin
+Pin* GetLinkedOutputPin(int inputPinId) {
+    for (const Link& link : links) {
+        if (link.toPinId == inputPinId) {
+            return GetPinById(link.fromPinId);
+        }
     }
+    return nullptr;
 }
 
-void UpdateDragLink() {
-    ImVec2 mousePos = ImGui::GetMousePos();
-    ImDrawList* drawList = ImGui::GetForegroundDrawList();
 
-    // Handle the case when dragging has started
-    if (isDraggingLink) {
-        // Draw the link as the user drags
-        ImVec2 start = dragStartPos;
-        ImVec2 end = mousePos; // The end follows the mouse position
-        ImVec2 control = ImVec2((start.x + end.x) / 2, (start.y + end.y) / 2 - 50);  // Modify this control point as necessary
+// Links are quadratic Bezier curves bowing upwards between their pins
+void LinkCurve(const ImVec2& start, const ImVec2& end, ImVec2& control) {
+    control = ImVec2((start.x + end.x) / 2, (start.y + end.y) / 2 - 50);
+}
 
-        // Draw the Bezier curve from the start to the current mouse position
-        DrawBezierCurve(drawList, start, end, control, IM_COL32(255, 255, 255, 255));
+// Flatten the curve into a polyline no further than a quarter pixel from it. A quadratic's
+// second derivative is constant, 2 * (start - 2 * control + end), so with n even steps each
+// chord strays at most |start - 2 * control + end| / (4 * n^2): straight links get one segment,
+// long bowed ones a few dozen.
+void TessellateLink(const ImVec2& start, const ImVec2& end, const ImVec2& control, vector<ImVec2>& points) {
+    const float Tolerance = 0.25f;
+    float ddx = start.x - 2 * control.x + end.x;
+    float ddy = start.y - 2 * control.y + end.y;
+    int segments = (int)ceilf(sqrtf(sqrtf(ddx * ddx + ddy * ddy) / (4 * Tolerance)));
+    segments = CLAMP(segments, 1, 64);
+    points.resize(segments + 1);
+    for (int i = 0; i <= segments; i++) {
+        float t = (float)i / segments;
+        float u = 1 - t;
+        points[i] = ImVec2(start.x * u * u + control.x * 2 * u * t + end.x * t * t,
+                           start.y * u * u + control.y * 2 * u * t + end.y * t * t);
     }
-    else if (activeLink) {
-        // Finalize the link when the mouse is released
-        Pin* fromPin = GetPinById(activeLink->fromPinId);
-        Pin* toPin = GetPinById(activeLink->toPinId);
+}
 
-        if (fromPin && toPin) {
-            ImVec2 start = fromPin->Pos;
-            ImVec2 end = toPin->Pos;
-            ImVec2 control = ImVec2((start.x + end.x) / 2, (start.y + end.y) / 2 - 50);  // Modify this control point as necessary
-            DrawBezierCurve(drawList, start, end, control, IM_COL32(255, 255, 255, 255));
-        }
+// Busy indicator: a ring of dots with a bright head that rotates over time
+void DrawSpinner(float radius, ImU32 color) {
+    ImVec2 pos = ImGui::GetCursorScreenPos();
+    ImVec2 center = ImVec2(pos.x + radius, pos.y + radius);
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    const int dots = 8;
+    int head = (int)(ImGui::GetTime() * dots) % dots;
+    for (int i = 0; i < dots; i++) {
+        float angle = 2.0f * 3.14159265f * i / dots;
+        int age = (head - i + dots) % dots;
+        ImU32 alpha = (ImU32)(255 - age * (200 / dots));
+        ImVec2 dot = ImVec2(center.x + cosf(angle) * radius * 0.75f, center.y + sinf(angle) * radius * 0.75f);
+        drawList->AddCircleFilled(dot, radius * 0.2f, (color & 0x00FFFFFF) | (alpha << 24));
     }
+    ImGui::Dummy(ImVec2(radius * 2.0f, radius * 2.0f));
 }
 
 // Start dragging the link (when a pin is clicked)
@@ -185,10 +281,10 @@ void EndDragLink(Pin* toPin) {
     }
 }
 
-// Function to draw links and handle dragging
-void DrawLinksAndHandleDrag(vector<Pin>& pins) {
+// Start and end link drags. Called once per frame, after UpdateCanvasHover().
+void HandleLinkMouse() {
     if (!isDraggingLink && ImGui::IsMouseDown(0)) {
-        Pin* fromPin = GetPinUnderMouse(pins); // Get the pin that was clicked
+        Pin* fromPin = GetPinUnderMouse(); // Get the pin that was clicked
         if (fromPin) {
             StartDragLink(fromPin);
         }
@@ -196,31 +292,180 @@ void DrawLinksAndHandleDrag(vector<Pin>& pins) {
 
     // Check for release (when mouse button is released)
     if (ImGui::IsMouseReleased(0)) {
-        Pin* toPin = GetPinUnderMouse(pins); // Get the pin under the mouse after drag
+        Pin* toPin = GetPinUnderMouse(); // Get the pin under the mouse after drag
         if (toPin && activeLink && toPin!=GetPinById(activeLink->fromPinId)) {
             EndDragLink(toPin);
         }
         else if (activeLink) {
             isDraggingLink = false;
+            delete activeLink;
             activeLink = nullptr;
         }
     }
+}
+
+// Links drawn last frame, keyed by their pins. A link is tessellated again only when one of
+// its ends moved.
+struct LinkTessellation {
+    ImVec2 start, end;
+    vector<ImVec2> points;
+    int frame = 0;      // ImGui frame the link was last drawn in
+};
+unordered_map<long long, LinkTessellation> g_LinkTessellations;
 
-    // Draw all existing links
+// Every link, and the one being dragged, in one pass per frame after the nodes have drawn.
+// Links whose bounds miss the canvas are skipped before they are tessellated.
+void DrawLinkLayer(const ImVec2& canvasMin, const ImVec2& canvasMax) {
+    const ImU32 LinkColor = IM_COL32(255, 255, 255, 255);
+    const float Thickness = 1.5f;
+    ImDrawList* drawList = ImGui::GetForegroundDrawList();
+    drawList->PushClipRect(canvasMin, canvasMax, true);
+    int frame = ImGui::GetFrameCount();
+
+    // GetPinById() scans, which two lookups per link cannot afford. Runs right after
+    // UpdatePinGeometry(), so g_PinIndexById matches Pins.
     for (const Link& link : links) {
-        Pin* fromPin = GetPinById(link.fromPinId);
-        Pin* toPin = GetPinById(link.toPinId);
+        auto fromPin = g_PinIndexById.find(link.fromPinId);
+        auto toPin = g_PinIndexById.find(link.toPinId);
+        if (fromPin == g_PinIndexById.end() || toPin == g_PinIndexById.end()) {
+            continue;
+        }
+        ImVec2 start = Pins[fromPin->second].Pos;
+        ImVec2 end = Pins[toPin->second].Pos;
+        ImVec2 control;
+        LinkCurve(start, end, control);
+
+        // The curve stays inside the triangle of its control points
+        float minX = std::min({ start.x, end.x, control.x }) - Thickness;
+        float maxX = std::max({ start.x, end.x, control.x }) + Thickness;
+        float minY = std::min({ start.y, end.y, control.y }) - Thickness;
+        float maxY = std::max({ start.y, end.y, control.y }) + Thickness;
+        if (maxX < canvasMin.x || minX > canvasMax.x || maxY < canvasMin.y || minY > canvasMax.y) {
+            continue;
+        }
 
-        if (fromPin && toPin) {
-            ImVec2 start = fromPin->Pos;
-            ImVec2 end = toPin->Pos;
-            ImVec2 control = ImVec2((start.x + end.x) / 2, (start.y + end.y) / 2 - 50);
-            DrawBezierCurve(ImGui::GetForegroundDrawList(), start, end, control, IM_COL32(255, 255, 255, 255));
+        long long key = (long long)(((unsigned long long)(unsigned int)link.fromPinId << 32) | (unsigned int)link.toPinId);
+        LinkTessellation& cached = g_LinkTessellations[key];
+        if (cached.points.empty() || cached.start.x != start.x || cached.start.y != start.y || cached.end.x != end.x || cached.end.y != end.y) {
+            cached.start = start;
+            cached.end = end;
+            TessellateLink(start, end, control, cached.points);
+        }
+        cached.frame = frame;
+        drawList->AddPolyline(cached.points.data(), (int)cached.points.size(), LinkColor, ImDrawFlags_None, Thickness);
+    }
+
+    // Forget links that were deleted or scrolled away
+    for (auto it = g_LinkTessellations.begin(); it != g_LinkTessellations.end();) {
+        if (it->second.frame != frame) {
+            it = g_LinkTessellations.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    // The link being dragged follows the mouse, so it is never cached
+    if (isDraggingLink) {
+        static vector<ImVec2> dragPoints;
+        ImVec2 end = ImGui::GetMousePos();
+        ImVec2 control;
+        LinkCurve(dragStartPos, end, control);
+        TessellateLink(dragStartPos, end, control, dragPoints);
+        drawList->AddPolyline(dragPoints.data(), (int)dragPoints.size(), LinkColor, ImDrawFlags_None, Thickness);
+    }
+    drawList->PopClipRect();
+}
+
+// The canvas background grid, as the vertices of one thin quad per line. It only changes with
+// the zoom, the canvas position or its size, so other frames copy the vertices straight into the
+// draw list instead of issuing an AddLine per line.
+//
+// Lines come in levels five times apart. The finest level drawn is the first at least
+// GridMinSpacing pixels apart, which within the canvas zoom range means the 20 px level down to
+// 60% and the 100 px level below. Every fifth line of a level is a major line. Zooming out from
+// 100% fades the minor lines out and the major ones down to the minor brightness, so at the
+// switch the major lines carry on as the next level's minor lines without a jump.
+const float CanvasZoomMin = 0.5f;
+const float CanvasZoomMax = 2.0f;
+
+struct GridGeometry {
+    float zoom = -1.0f;
+    ImVec2 pos, size;
+    vector<ImDrawVert> vertices;    // Four per line, in PrimRect order
+};
+
+void BuildGridGeometry(GridGeometry& grid, const ImVec2& canvasPos, const ImVec2& canvasSize, float zoom) {
+    const float BaseSpacing = 20.0f;                    // Minor lines at 100%
+    const float GridMinSpacing = BaseSpacing * 0.6f;    // Finer levels are skipped
+    const float GridFadedInSpacing = BaseSpacing;       // Minor lines at full brightness from here
+    const int MajorEvery = 5;
+    grid.zoom = zoom;
+    grid.pos = canvasPos;
+    grid.size = canvasSize;
+    grid.vertices.clear();
+
+    float spacing = BaseSpacing * zoom;
+    while (spacing < GridMinSpacing) {
+        spacing *= MajorEvery;
+    }
+    float fade = CLAMP((spacing - GridMinSpacing) / (GridFadedInSpacing - GridMinSpacing), 0.0f, 1.0f);
+    ImU32 minorColor = IM_COL32(200, 200, 200, (int)(40 * fade));
+    ImU32 majorColor = IM_COL32(200, 200, 200, (int)(40 + 20 * fade));
+    ImVec2 uv = ImGui::GetFontTexUvWhitePixel();
+
+    auto addQuad = [&](ImVec2 a, ImVec2 b, ImU32 color) {
+        ImVec2 corners[4] = { a, ImVec2(b.x, a.y), b, ImVec2(a.x, b.y) };
+        for (const ImVec2& corner : corners) {
+            ImDrawVert v;
+            v.pos = corner;
+            v.uv = uv;
+            v.col = color;
+            grid.vertices.push_back(v);
         }
+    };
+    // Lines stay anchored to the canvas origin, as before
+    int columns = (int)(canvasSize.x / spacing);
+    for (int i = 0; i <= columns; i++) {
+        float x = floorf(canvasPos.x + i * spacing);
+        addQuad(ImVec2(x, canvasPos.y), ImVec2(x + 1, canvasPos.y + canvasSize.y), i % MajorEvery ? minorColor : majorColor);
+    }
+    int rows = (int)(canvasSize.y / spacing);
+    for (int i = 0; i <= rows; i++) {
+        float y = floorf(canvasPos.y + i * spacing);
+        addQuad(ImVec2(canvasPos.x, y), ImVec2(canvasPos.x + canvasSize.x, y + 1), i % MajorEvery ? minorColor : majorColor);
+    }
+}
+
+void DrawCanvasGrid(ImDrawList* drawList, const ImVec2& canvasPos, const ImVec2& canvasSize, float zoom) {
+    static GridGeometry grid;
+    if (grid.zoom != zoom || grid.pos.x != canvasPos.x || grid.pos.y != canvasPos.y ||
+        grid.size.x != canvasSize.x || grid.size.y != canvasSize.y) {
+        BuildGridGeometry(grid, canvasPos, canvasSize, zoom);
     }
 
-    // Draw the dragging link (if any)
-    UpdateDragLink();
+    // In batches, so the indices of one batch always fit in ImDrawIdx
+    const int QuadsPerBatch = 8192;
+    int quads = (int)grid.vertices.size() / 4;
+    for (int first = 0; first < quads; first += QuadsPerBatch) {
+        int count = std::min(QuadsPerBatch, quads - first);
+        drawList->PrimReserve(count * 6, count * 4);
+        unsigned int base = drawList->_VtxCurrentIdx;
+        memcpy(drawList->_VtxWritePtr, &grid.vertices[(size_t)first * 4], (size_t)count * 4 * sizeof(ImDrawVert));
+        for (int q = 0; q < count; q++) {
+            ImDrawIdx* idx = drawList->_IdxWritePtr + q * 6;
+            ImDrawIdx v = (ImDrawIdx)(base + q * 4);
+            idx[0] = v;
+            idx[1] = (ImDrawIdx)(v + 1);
+            idx[2] = (ImDrawIdx)(v + 2);
+            idx[3] = v;
+            idx[4] = (ImDrawIdx)(v + 2);
+            idx[5] = (ImDrawIdx)(v + 3);
+        }
+        drawList->_VtxWritePtr += count * 4;
+        drawList->_IdxWritePtr += count * 6;
+        drawList->_VtxCurrentIdx += count * 4;
+    }
 }
 
 ID3D11PixelShader* g_brightnessShader = nullptr;  // Pixel Shader
@@ -376,23 +621,15 @@ void DrawObject(ID3D11ShaderResourceView* textureSRV, ID3D11SamplerState* sample
 
 
 
-ID3D11ShaderResourceView* LoadTextureFromFileDX11(const char* filename, int* outWidth, int* outHeight)
+// Upload a decoded image into a new texture. Raw and RGBA PAM files are still a view of the
+// file mapping here, so they go to the driver without an intermediate copy.
+// Only uses the device (which is free-threaded), never the immediate context, so worker
+// threads may call this.
+ID3D11ShaderResourceView* CreateTextureFromImage(const ImageData& image)
 {
-    int imageWidth = 0;
-    int imageHeight = 0;
-    int nChannels = 0;
-
-    stbi_set_flip_vertically_on_load(1);
-    unsigned char* imageData = stbi_load(filename, &imageWidth, &imageHeight, &nChannels, 4);
-    if (!imageData)
-        return nullptr;
-
-    *outWidth = imageWidth;
-    *outHeight = imageHeight;
-
     D3D11_TEXTURE2D_DESC desc = {};
-    desc.Width = imageWidth;
-    desc.Height = imageHeight;
+    desc.Width = image.width;
+    desc.Height = image.height;
     desc.MipLevels = 1;
     desc.ArraySize = 1;
     desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
@@ -402,12 +639,11 @@ ID3D11ShaderResourceView* LoadTextureFromFileDX11(const char* filename, int* out
     desc.CPUAccessFlags = 0;
 
     D3D11_SUBRESOURCE_DATA initData = {};
-    initData.pSysMem = imageData;
-    initData.SysMemPitch = imageWidth * 4;
+    initData.pSysMem = image.pixels;
+    initData.SysMemPitch = image.stride;
 
     ID3D11Texture2D* texture = nullptr;
     HRESULT hr = g_pd3dDevice->CreateTexture2D(&desc, &initData, &texture);
-    stbi_image_free(imageData);
 
     if (FAILED(hr))
         return nullptr;
@@ -424,6 +660,26 @@ ID3D11ShaderResourceView* LoadTextureFromFileDX11(const char* filename, int* out
     return srv;
 }
 
+// Longest side of the textures nodes display. Node previews are about 150 px wide; this keeps
+// them sharp on high-DPI screens without uploading, or letting the sampler alias, whole images.
+static const int NodePreviewSize = 300;
+
+// Copy an image into an existing texture of the same size, avoiding a new allocation per
+// frame during playback. Uses the immediate context, so UI thread only. False if the sizes differ.
+bool UpdateTextureFromImage(ID3D11ShaderResourceView* srv, const ImageData& image)
+{
+    ID3D11Resource* resource = nullptr;
+    srv->GetResource(&resource);
+    D3D11_TEXTURE2D_DESC desc = {};
+    static_cast<ID3D11Texture2D*>(resource)->GetDesc(&desc);  // Our SRVs always view a Texture2D
+    bool fits = desc.Width == (UINT)image.width && desc.Height == (UINT)image.height;
+    if (fits) {
+        g_pd3dDeviceContext->UpdateSubresource(resource, 0, nullptr, image.pixels, image.stride, 0);
+    }
+    resource->Release();
+    return fits;
+}
+
 //void ApplyBrightnessContrastShader(ID3D11ShaderResourceView* imageSRV, float brightness, float contrast) {
 //    // Assuming you have a shader already loaded into the device context
 //    ID3D11DeviceContext* deviceContext; // Get your device context
@@ -452,6 +708,9 @@ ID3D11ShaderResourceView* LoadTextureFromFileDX11(const char* filename, int* out
 
 
 
+// Files loaded by input nodes, so they can be reloaded when edited in other programs
+static FileWatcher g_FileWatcher;
+
 // Node Class
 
 class BaseNode {
@@ -467,6 +726,13 @@ public:
     int NumOfInputPins = 1;
     int NumOfOutputPins = 1;
 
+    // NodeId interned in g_PinStrings, which is what pins store as their ParentNode
+    int PinOwner() {
+        if (pinOwner < 0) {
+            pinOwner = g_PinStrings.Intern(NodeId);
+        }
+        return pinOwner;
+    }
 
     virtual void Draw(ImVec2 gridMin, ImVec2 gridMax, string& NodeName) {
         if (!resized) {
@@ -487,7 +753,8 @@ public:
             ImVec2 winPos = ImGui::GetWindowPos();
             ImVec2 winSize = ImGui::GetWindowSize();
 
-            if (ImGui::IsWindowHovered() && ImGui::IsMouseDragging(0)) {
+            // A drag that started on a pin pulls a link, not the node
+            if (ImGui::IsWindowHovered() && ImGui::IsMouseDragging(0) && !isDraggingLink) {
                 ImVec2 delta = ImGui::GetIO().MouseDelta;
                 winPos.x += delta.x;
                 winPos.y += delta.y;
@@ -500,6 +767,9 @@ public:
 
             selected = ImGui::IsWindowHovered() && ImGui::IsMouseClicked(0);
 
+            // Moves it in the grid only when it changed cells
+            g_NodeGrid.Update(PinOwner(), GridRect{ winPos.x, winPos.y, winPos.x + winSize.x, winPos.y + winSize.y });
+
             DrawContent();
         }
         ImGui::End();
@@ -510,19 +780,146 @@ public:
     }
 
     virtual void DrawContent() = 0;
-    virtual ~BaseNode() = default;
+
+    // Place the pins at their offsets from the window's top-left corner and publish them in
+    // Pins. Proxies do this too, so links keep following a node that is not drawn in full.
+    void LayoutPins(ImVec2 winPos) {
+        float InitialLoc = 120.0f;
+        for (Pin& pin : inputPins) {
+            pin.Pos = ImVec2(winPos.x, winPos.y + InitialLoc);
+        }
+        for (Pin& pin : outputPins) {
+            pin.Pos = ImVec2(winPos.x + size.x, winPos.y + InitialLoc);  // Right edge of node
+        }
+        Pins.erase(remove_if(Pins.begin(), Pins.end(), [this](const Pin& p) { return p.ParentNode == this->PinOwner(); }), Pins.end());
+        Pins.insert(Pins.end(), inputPins.begin(), inputPins.end());
+        Pins.insert(Pins.end(), outputPins.begin(), outputPins.end());
+    }
+
+    // Called every frame before drawing, also for nodes drawn as a proxy:
+    // anything that must keep going off-screen (finished jobs, playback) goes here
+    virtual void Update() {}
+
+    // Has work in flight or is animating. While any node is busy the main loop keeps drawing
+    // frames, up to the frame rate cap, instead of waiting for input.
+    virtual bool Busy() const { return false; }
+
+    // Size of the node on screen. Windows are laid out at their own size: the canvas zoom only
+    // scales the grid behind them.
+    ImVec2 ScreenSize() const { return size; }
+
+    // Stand-in for a node too small on screen to use its widgets: its frame, title and pins
+    // where the window was last drawn, without the window and its widgets
+    void DrawProxy(ImDrawList* drawList) {
+        const GridRect& r = g_NodeGrid.Rect(PinOwner());
+        LayoutPins(ImVec2(r.x0, r.y0));
+        drawList->AddRectFilled(ImVec2(r.x0, r.y0), ImVec2(r.x1, r.y1), selected ? IM_COL32(212, 28, 28, 255) : IM_COL32(59, 59, 56, 255), 7.0f);
+        drawList->AddText(ImVec2(r.x0 + 8.0f, r.y0 + 4.0f), IM_COL32(255, 255, 255, 255), NodeName.c_str());
+        for (const Pin& pin : inputPins) {
+            drawList->AddCircleFilled(pin.Pos, 5.0f, IM_COL32(255, 255, 255, 255));
+        }
+        for (const Pin& pin : outputPins) {
+            drawList->AddCircleFilled(pin.Pos, 5.0f, IM_COL32(255, 255, 255, 255));
+        }
+    }
+
+    virtual ~BaseNode() {
+        g_NodeGrid.Remove(PinOwner());
+    }
+
+    // CPU path used when an image is pulled through the graph a strip at a time. Nodes that
+    // change pixels return a kernel which reads a strip of RGBA8 rows from 'src' and writes the
+    // result to 'dst', both the same size. Rows are aligned and padded (see ImageBuffer.h), so
+    // kernels may run vector loops past the last pixel of a row without an epilogue. The kernel
+    // captures the current parameters by value, so it can run on a worker thread while the UI
+    // keeps editing them. Temporaries come from ScratchArena::ForThread() and are released after
+    // every strip.
+    typedef std::function<void(const ImageBuffer& src, ImageBuffer& dst)> StripKernel;
+    virtual StripKernel MakeStripKernel() { return nullptr; }
+
+    // Each output pixel depends only on the same input pixel, so the kernel may be handed the
+    // same buffer as 'src' and 'dst' (see MemoryPlanner.h)
+    virtual bool IsElementwise() const { return true; }
+
+    struct StripStage {
+        StripKernel kernel;
+        bool elementwise = true;
+        string nodeId;          // The node that made the kernel
+        int revision = 0;       // Its paramRevision when the kernel was made
+    };
+
+    // Bumped whenever a parameter that changes the kernel's output is edited, so evaluations
+    // can tell when their result went stale
+    int paramRevision = 0;
+
+    // Source nodes: produce the current output image on a worker thread. Like strip kernels,
+    // the function captures what it needs by value when it is made on the UI thread.
+    typedef std::function<bool(ImageData& out)> ImageSource;
+    virtual ImageSource MakeImageSource() { return nullptr; }
+
+    // A watched file was changed on disk by another program
+    virtual void OnFileChanged(const string& path) {}
+
+    // Bumped by source nodes whenever their output image is replaced, so downstream nodes can
+    // tell whether they are up to date
+    int outputRevision = 0;
+
+private:
+    int pinOwner = -1;
 };
 
+vector<std::unique_ptr<BaseNode>> nodes;
+
+BaseNode* FindNodeById(const string& nodeId) {
+    for (auto& node : nodes) {
+        if (node->NodeId == nodeId) {
+            return node.get();
+        }
+    }
+    return nullptr;
+}
+
+// Walk upstream from an input pin to the node at the start of the chain, which has no inputs.
+// If 'stages' is given it receives the strip kernels of the nodes in between, in the order they
+// apply. Returns nullptr if the chain is not connected all the way.
+BaseNode* FindUpstreamSource(int inputPinId, vector<BaseNode::StripStage>* stages) {
+    for (size_t depth = 0; depth <= nodes.size(); depth++) {    // Bounded in case of a cycle
+        Pin* pin = GetLinkedOutputPin(inputPinId);
+        BaseNode* node = pin ? FindNodeById(g_PinStrings.Get(pin->ParentNode)) : nullptr;
+        if (!node) {
+            return nullptr;
+        }
+        if (node->inputPins.empty()) {
+            if (stages) {
+                reverse(stages->begin(), stages->end());
+            }
+            return node;
+        }
+        if (stages) {
+            BaseNode::StripStage stage;
+            stage.kernel = node->MakeStripKernel();
+            stage.elementwise = node->IsElementwise();
+            stage.nodeId = node->NodeId;
+            stage.revision = node->paramRevision;
+            if (stage.kernel) {
+                stages->push_back(stage);
+            }
+        }
+        inputPinId = node->inputPins[0].id;
+    }
+    return nullptr;
+}
+
 // Brightness Node
 
 class BrightnessNode : public BaseNode {
 public:
     bool CanChangeBrightNess = false;
-    ID3D11ShaderResourceView* imageSRV = nullptr;
+    ImageHandle image;
     BrightnessNode() {
         NodeName = "Brightness Node";
         int num = GetNextPinId();
-        NodeId = NodeName + "num";
+        NodeId = NodeName + to_string(num);
         NumOfInputPins = 1;
         NumOfOutputPins = 1;
         ImVec2 winPos = ImGui::GetWindowPos();
@@ -532,35 +929,82 @@ public:
         for (int i = 0;i < NumOfInputPins;i++) {
             ImVec2 localPos = ImVec2(0, InitialLoc);
             string PinName1 = "In";
-            inputPins.push_back({ GetNextPinId(),PinName1 + "##" + to_string(i),ImVec2(winPos.x + localPos.x, winPos.y + localPos.y),true,NodeId });
+            inputPins.push_back({ GetNextPinId(),g_PinStrings.Intern(PinName1 + "##" + to_string(i)),ImVec2(winPos.x + localPos.x, winPos.y + localPos.y),true,PinOwner() });
         }
         for (int j = 0;j < NumOfOutputPins;j++) {
             ImVec2 localPos = ImVec2(0, InitialLoc);
             string PinName2 = "Out";
-            outputPins.push_back({ GetNextPinId(),PinName2 + "##" + to_string(j),ImVec2(winPos.x + localPos.x, winPos.y + localPos.y),false,NodeId });
+            outputPins.push_back({ GetNextPinId(),g_PinStrings.Intern(PinName2 + "##" + to_string(j)),ImVec2(winPos.x + localPos.x, winPos.y + localPos.y),false,PinOwner() });
         }
         
     }
+    // Edited by the sliders on the UI thread only. Workers read 'params', which the UI
+    // publishes after every edit.
     float brightness = 0.0f;
     float contrast = 1.0f;
 
+    struct Params {
+        float brightness;
+        float contrast;
+    };
+    ParamChannel<Params> params{ Params{ 0.0f, 1.0f } };
+
+    void PublishParams() {
+        params.Publish(Params{ brightness, contrast });
+        paramRevision = (int)params.Version();
+    }
+
+    // Same transfer as BrightnessContrast.hlsl, with the slider's brightness read as a percentage
+    // of full scale. Eight bits in, eight bits out, so it reduces to a lookup table. Safe to call
+    // from any thread.
+    StripKernel MakeStripKernel() override {
+        Params p = params.Read();
+        std::array<unsigned char, 256> lut;
+        for (int i = 0; i < 256; i++) {
+            float c = ((i / 255.0f) - 0.5f) * p.contrast + 0.5f + p.brightness / 100.0f;
+            lut[i] = (unsigned char)(CLAMP(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+        return [lut](const ImageBuffer& src, ImageBuffer& dst) {
+            for (int y = 0; y < src.height; y++) {
+                const unsigned char* s = src.Row(y);
+                unsigned char* d = dst.Row(y);
+                for (int x = 0; x < src.width; x++, s += 4, d += 4) {
+                    d[0] = lut[s[0]];
+                    d[1] = lut[s[1]];
+                    d[2] = lut[s[2]];
+                    d[3] = s[3];
+                }
+            }
+        };
+    }
+
+    void Update() override {
+        for (auto& pin : Pins) {
+            if (pin.ParentNode == PinOwner() && pin.IsConnectedToMiddle) {
+                cout << "Yes You are Close" << endl;
+                image = pin.image;
+                CanChangeBrightNess = true;
+            }
+        }
+
+        if (CanChangeBrightNess) {
+ 
+            //UpdateConstantBuffer(brightness, contrast);
+        }
+    }
+
     void DrawContent() override {
         ImDrawList* drawList = ImGui::GetForegroundDrawList();
-        ImVec2 winPos = ImGui::GetWindowPos();
         ImVec2 winSize = ImGui::GetWindowSize();
-        float InitialLoc = 120.0f;
+        LayoutPins(ImGui::GetWindowPos());
 
         // Draw input pins
         for (int i = 0; i < inputPins.size(); ++i) {
-            ImVec2 localPos = ImVec2(0, InitialLoc); // Local offset inside the node
-            inputPins[i].Pos = ImVec2(winPos.x + localPos.x, winPos.y + localPos.y);
             drawList->AddCircleFilled(inputPins[i].Pos, 5.0f, IM_COL32(255, 255, 255, 255));
         }
 
         // Draw output pins
         for (int i = 0; i < outputPins.size(); ++i) {
-            ImVec2 localPos = ImVec2(size.x, InitialLoc); // Right edge of node
-            outputPins[i].Pos = ImVec2(winPos.x + localPos.x, winPos.y + localPos.y);
             drawList->AddCircleFilled(outputPins[i].Pos, 5.0f, IM_COL32(255, 255, 255, 255));
         }
         float controlsWidth = 120.0f;   // Slider width
@@ -583,12 +1027,15 @@ public:
 
         ImGui::SetCursorPosX(center.x);
         ImGui::SetNextItemWidth(controlsWidth);
-        ImGui::SliderFloat("##Brightness", &brightness, -100.0f, 100.0f, "%.1f");
+        if (ImGui::SliderFloat("##Brightness", &brightness, -100.0f, 100.0f, "%.1f")) {
+            PublishParams();
+        }
 
         // Center the short Reset button
         ImGui::SetCursorPosX(center.x + (controlsWidth - resetButtonWidth) * 0.5f);
         if (ImGui::Button("Reset##0", ImVec2(resetButtonWidth, 0))) {
             brightness = 0.0f;
+            PublishParams();
         }
 
         // Gap
@@ -600,33 +1047,17 @@ public:
 
         ImGui::SetCursorPosX(center.x);
         ImGui::SetNextItemWidth(controlsWidth);
-        ImGui::SliderFloat("##Contrast", &contrast, 0.0f, 3.0f, "%.2f");
+        if (ImGui::SliderFloat("##Contrast", &contrast, 0.0f, 3.0f, "%.2f")) {
+            PublishParams();
+        }
 
         ImGui::SetCursorPosX(center.x + (controlsWidth - resetButtonWidth) * 0.5f);
         if (ImGui::Button("Reset##1", ImVec2(resetButtonWidth, 0))) {
             contrast = 1.0f;
+            PublishParams();
         }
 
         ImGui::EndGroup();
-        for (auto& pin : Pins) {
-            if (pin.ParentNodeId== this->NodeId && pin.IsConnectedToMiddle) {
-                cout << "Yes You are Close" << endl;
-                imageSRV = pin.imageSRV;
-                CanChangeBrightNess = true;
-            }
-        }
-
-        if (CanChangeBrightNess) {
- 
-            //UpdateConstantBuffer(brightness, contrast);
-        }
-   
-        Pins.erase(remove_if(Pins.begin(), Pins.end(), [this](const Pin& p) {return p.ParentNodeId == this->NodeId;}), Pins.end());
-        Pins.insert(Pins.end(), inputPins.begin(), inputPins.end());
-        Pins.insert(Pins.end(), outputPins.begin(), outputPins.end());
-        DrawLinksAndHandleDrag(Pins);
-
-
     }
 };
 
@@ -636,7 +1067,7 @@ class InputImageNode : public BaseNode {
 public:
     InputImageNode() {
         NodeName = "Input Image";
-        NodeId = NodeName + "num";
+        NodeId = NodeName + to_string(GetNextPinId());
         NumOfInputPins = 0;
         NumOfOutputPins = 1;
 
@@ -644,17 +1075,18 @@ public:
         float InitialLoc = 120.0f;
         ImVec2 localPos = ImVec2(size.x, InitialLoc);
         std::string PinName = "Out";
-        outputPins.push_back({ GetNextPinId(), PinName + "##0", ImVec2(winPos.x + localPos.x, winPos.y + localPos.y), false, NodeId , 6.2f,true});
+        outputPins.push_back({ GetNextPinId(), g_PinStrings.Intern(PinName + "##0"), ImVec2(winPos.x + localPos.x, winPos.y + localPos.y), false, PinOwner() , 6.2f,true});
     }
 
+    // A load still running (the user may be sitting in the file dialog) is cancelled and left to
+    // finish on its own; it only refers to its LoadState
     ~InputImageNode() {
-        if (imageSRV) {
-            imageSRV->Release();
-            imageSRV = nullptr;
-        }
+        loadGenerations.CancelAll();
+        loadJob.Detach();
+        g_FileWatcher.Unwatch(filePath);
     }
 
-    std::string OpenImageFileDialog() {
+    static std::string OpenImageFileDialog() {
         OPENFILENAME ofn;
         wchar_t szFile[260] = {};
         ZeroMemory(&ofn, sizeof(ofn));
@@ -662,7 +1094,7 @@ public:
         ofn.hwndOwner = nullptr;
         ofn.lpstrFile = szFile;
         ofn.nMaxFile = sizeof(szFile) / sizeof(wchar_t);
-        ofn.lpstrFilter = L"Image Files\0*.BMP;*.JPG;*.PNG;*.JPEG\0All Files\0*.*\0";
+        ofn.lpstrFilter = L"Image Files\0*.BMP;*.JPG;*.PNG;*.JPEG;*.QOI;*.PPM;*.PAM;*.PFM;*.RAW\0All Files\0*.*\0";
         ofn.nFilterIndex = 1;
         ofn.lpstrTitle = L"Open Image File";
         ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
@@ -675,41 +1107,220 @@ public:
         return "";
     }
 
-    void LoadImage(const std::string& filePath) {
-        if (imageSRV) {
-            imageSRV->Release();
-            imageSRV = nullptr;
-        }
+    enum LoadStage {
+        LoadStage_Idle,
+        LoadStage_ChoosingFile,
+        LoadStage_Decoding,
+        LoadStage_Uploading,
+    };
+
+    // Shared between the node and its load, which may outlive it
+    struct LoadState {
+        std::atomic<int> stage{ LoadStage_Idle };
+        std::atomic<float> progress{ 0.0f };
+    };
+
+    struct LoadResult {
+        ImageHandle image;      // Preview-sized
+        int width = 0;
+        int height = 0;
+        std::string filePath;
+        bool streamed = false;
+    };
+
+    // Longest side of the preview texture of a streamed image
+    static const int StreamPreviewSize = 2048;
+
+    // Cache key of the pixels shown for a file: the preview when streamed, the image otherwise
+    static std::string DisplayCacheKey(const std::string& path, bool streamed) {
+        return streamed ? path + "#preview" : path;
+    }
 
-        stbi_set_flip_vertically_on_load(0);
-        imageSRV = LoadTextureFromFileDX11(filePath.c_str(), &imageWidth, &imageHeight);
-        outputPins[0].imageSRV = imageSRV; // Set the imageSRV to the output pin
-        imageLoaded = (imageSRV != nullptr);
-        
+    // Decode what the node shows for 'path': a downscaled preview when streaming (if the format
+    // allows it; 'stream' is cleared otherwise), the whole image if not. The pixels are cached,
+    // so saves and preview evaluations don't decode the file again.
+    static bool DecodeForDisplay(const std::string& path, bool& stream, ImageData& image, int& width, int& height,
+                                 std::atomic<float>* progress) {
+        auto decodeStart = std::chrono::steady_clock::now();
+        bool decoded = false;
+        std::unique_ptr<ImageStripReader> reader = stream ? OpenImageStripReader(path) : nullptr;
+        stream = reader != nullptr;
+        if (stream) {
+            // Keep only a downscaled preview; full resolution rows are read again from the file,
+            // a strip at a time, whenever the graph is saved
+            decoded = ReadImagePreview(*reader, StreamPreviewSize, image, progress);
+            width = reader->Width();
+            height = reader->Height();
+        }
+        else {
+            decoded = ReadImageFile(path, image, progress);
+            width = image.width;
+            height = image.height;
+        }
+        // Raw and PAM files are views of a mapping that would keep the file locked, and cost
+        // nothing to map again anyway
+        ImageFileFormat format = ImageFormatFromPath(path);
+        if (decoded && (stream || (format != ImageFileFormat_Raw && format != ImageFileFormat_PAM))) {
+            std::chrono::duration<double> decodeTime = std::chrono::steady_clock::now() - decodeStart;
+            CachePut(DisplayCacheKey(path, stream), image, decodeTime.count());
+        }
+        return decoded;
+    }
 
+    ImageSource MakeImageSource() override {
         if (!imageLoaded) {
+            return nullptr;
+        }
+        std::string path = filePath;
+        bool stream = streamed;
+        return [path, stream](ImageData& out) {
+            if (CacheGet(DisplayCacheKey(path, stream), out)) {
+                return true;
+            }
+            bool decodeStream = stream;
+            int width = 0, height = 0;
+            return DecodeForDisplay(path, decodeStream, out, width, height, nullptr);
+        };
+    }
+
+    // Runs off the UI thread so it keeps drawing frames meanwhile. The file dialog, decoding and
+    // the texture upload all run on the pool. The dialog is skipped if 'path' is given. Static,
+    // so it can outlive the node: a cancelled load stops at its next step.
+    static Task<LoadResult> LoadImageTask(std::string path, bool stream, std::shared_ptr<LoadState> state, CancelToken cancel) {
+        LoadResult result;
+        result.filePath = path;
+        if (result.filePath.empty()) {
+            state->stage = LoadStage_ChoosingFile;
+            result.filePath = co_await RunBlocking([]() {
+                CoInitialize(nullptr);  // The common dialogs need COM on the calling thread
+                std::string chosen = OpenImageFileDialog();
+                CoUninitialize();
+                return chosen;
+            });
+            if (result.filePath.empty() || cancel.IsCancelled())
+                co_return result;
+        }
+
+        state->stage = LoadStage_Decoding;
+        ImageData image;
+        result.streamed = stream;
+        bool decoded = DecodeForDisplay(result.filePath, result.streamed, image, result.width, result.height, &state->progress);
+        if (cancel.IsCancelled())
+            co_return result;
+        if (!decoded) {
             std::cerr << "Failed to load image." << std::endl;
+            co_return result;
+        }
+
+        // Only a box-filtered copy the size of the node's preview goes to the GPU; evaluations
+        // take the full pixels from the cache
+        state->stage = LoadStage_Uploading;
+        ImageData preview;
+        if (MakeImagePreview(image, NodePreviewSize, preview)) {
+            result.image = MakeImageHandle(CreateTextureFromImage(preview), preview.width, preview.height);
+        }
+        if (!result.image) {
+            std::cerr << "Failed to create texture for image." << std::endl;
+        }
+        co_return result;
+    }
+
+    // Without a path the user is asked for one
+    void StartLoadImage(const std::string& path, bool stream) {
+        loadState->progress = 0.0f;
+        loadState->stage = path.empty() ? LoadStage_ChoosingFile : LoadStage_Decoding;
+        loadJob = LoadImageTask(path, stream, loadState, loadGenerations.Next());
+        loadJob.Start();
+    }
+
+    // Decode the file again, the same way as before. If a load is already running the reload
+    // waits for it, since that load may have read the file before this change.
+    void OnFileChanged(const string& path) override {
+        if (path != filePath)
+            return;
+        CacheErase(DisplayCacheKey(filePath, streamed));
+        if (loadJob.Valid()) {
+            reloadPending = true;
+            return;
+        }
+        StartLoadImage(filePath, streamed);
+    }
+
+    // Swap a finished load in between frames. The previous image may still be referenced by
+    // draw commands recorded this frame, so our handle to it is only dropped on the next one.
+    void PollLoadImage() {
+        retiredImage = nullptr;
+        if (!loadJob.IsReady())
+            return;
+
+        LoadResult result = loadJob.Get();
+        loadState->stage = LoadStage_Idle;
+        if (result.image) {   // A failed reload keeps the previous image
+            if (result.filePath != filePath) {
+                g_FileWatcher.Watch(result.filePath);
+                g_FileWatcher.Unwatch(filePath);
+            }
+            retiredImage = image;
+            image = result.image;
+            imageWidth = result.width;
+            imageHeight = result.height;
+            filePath = result.filePath;
+            streamed = result.streamed;
+            outputPins[0].image = image; // Shared with every consumer, not copied
+            imageLoaded = true;
+            outputRevision++;
+        }
+        if (reloadPending) {
+            reloadPending = false;
+            StartLoadImage(filePath, streamed);
         }
     }
 
+    void DrawLoadProgress() {
+        int stage = loadState->stage;
+        const char* label = stage == LoadStage_ChoosingFile ? "Choosing file..." : stage == LoadStage_Decoding ? "Decoding..." : "Uploading...";
+        DrawSpinner(ImGui::GetTextLineHeight() * 0.5f, IM_COL32(255, 255, 255, 255));
+        ImGui::SameLine();
+        ImGui::Text("%s", label);
+        if (stage == LoadStage_Decoding) {
+            ImGui::ProgressBar(loadState->progress, ImVec2(ImGui::GetContentRegionAvail().x, 0));
+        }
+    }
+
+    // The file behind the current image, for evaluations that read it again at full resolution
+    const std::string& GetFilePath() const { return filePath; }
+
+    void Update() override {
+        PollLoadImage();
+    }
+
+    bool Busy() const override {
+        return loadJob.Valid();
+    }
+
     void DrawContent() override {
         ImDrawList* drawList = ImGui::GetForegroundDrawList();
-        ImVec2 winPos = ImGui::GetWindowPos();
-        float InitialLoc = 120.0f;
-        ImVec2 localPos = ImVec2(size.x, InitialLoc);
-        outputPins[0].Pos = ImVec2(winPos.x + localPos.x, winPos.y + localPos.y);
+        LayoutPins(ImGui::GetWindowPos());
         drawList->AddCircleFilled(outputPins[0].Pos, 5.0f, IM_COL32(255, 255, 255, 255));
 
         ImGui::Text("Image Source");
 
+        bool loading = loadJob.Valid();
+        ImGui::BeginDisabled(loading);
         if (ImGui::Button("Load Image")) {
-            std::string filePath = OpenImageFileDialog();
-            if (!filePath.empty()) {
-                LoadImage(filePath); // Call image loading outside draw call
-            }
+            StartLoadImage("", streamFromDisk);
         }
+        ImGui::Checkbox("Stream from disk", &streamFromDisk);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("For images too large to decode whole (PNG, PPM, PAM, raw).\nOnly a preview is kept in memory.");
+        }
+        ImGui::EndDisabled();
 
-        if (imageLoaded && imageSRV != nullptr && imageWidth > 0 && imageHeight > 0) {
+        if (loading) {
+            DrawLoadProgress();
+        }
+
+        if (imageLoaded && image && imageWidth > 0 && imageHeight > 0) {
             float maxWidth = ImGui::GetContentRegionAvail().x;
             float aspectRatio = (float)imageHeight / (float)imageWidth;
             float displayWidth = (maxWidth > imageWidth) ? imageWidth : maxWidth;
@@ -717,25 +1328,28 @@ public:
 
             ImGui::Text("Preview:");
             ImGui::BeginChild("ImagePreview", ImVec2(displayWidth, displayHeight), true);
-            ImGui::Image((ImTextureID)imageSRV, ImVec2(displayWidth, displayHeight));
+            ImGui::Image((ImTextureID)image->srv, ImVec2(displayWidth, displayHeight));
             ImGui::EndChild();
+            if (streamed) {
+                ImGui::Text("Streamed, %d x %d", imageWidth, imageHeight);
+            }
         }
-
-        // Update pins
-        Pins.erase(std::remove_if(Pins.begin(), Pins.end(), [this](const Pin& p) {
-            return p.ParentNodeId == this->NodeId;
-            }), Pins.end());
-
-        Pins.insert(Pins.end(), outputPins.begin(), outputPins.end());
-
-        DrawLinksAndHandleDrag(Pins);
     }
 
 private:
-    ID3D11ShaderResourceView* imageSRV = nullptr;
+    ImageHandle image;
+    ImageHandle retiredImage;
     int imageWidth = 500;
     int imageHeight = 1000;
     bool imageLoaded = false;
+    bool streamFromDisk = false;
+    bool streamed = false;      // image is only a preview of the file
+    bool reloadPending = false; // The file changed while a load was running
+    std::string filePath;       // Watched for changes while it is loaded
+
+    Task<LoadResult> loadJob;
+    std::shared_ptr<LoadState> loadState = std::make_shared<LoadState>();
+    EvaluationGenerations loadGenerations;
 };
 
 
@@ -743,15 +1357,235 @@ private:
 
 
 
+class ImageSequenceNode : public BaseNode {
+public:
+    char pattern[260] = "";
+    ImageSequenceNode() {
+        NodeName = "Image Sequence";
+        NodeId = NodeName + to_string(GetNextPinId());
+        NumOfInputPins = 0;
+        NumOfOutputPins = 1;
+
+        ImVec2 winPos = ImGui::GetWindowPos();
+        float InitialLoc = 120.0f;
+        ImVec2 localPos = ImVec2(size.x, InitialLoc);
+        std::string PinName = "Out";
+        outputPins.push_back({ GetNextPinId(), g_PinStrings.Intern(PinName + "##0"), ImVec2(winPos.x + localPos.x, winPos.y + localPos.y), false, PinOwner(), 6.2f, true });
+    }
+
+    ~ImageSequenceNode() {
+        prefetcher.Close();
+    }
+
+    const vector<SequenceFrame>& GetFrames() const { return frames; }
+
+    void OpenSequence() {
+        prefetcher.Close();
+        if (!ListImageSequence(pattern, frames)) {
+            frames.clear();
+            status = "No frames match.";
+            return;
+        }
+        prefetcher.Open(frames, loop);
+        currentFrame = 0;
+        displayedFrame = -1;
+        playing = false;
+        playClock = 0.0;
+        status.clear();
+    }
+
+    // Advance the playhead by the time since the last frame
+    void UpdatePlayback() {
+        int count = (int)frames.size();
+        if (!playing || count == 0) {
+            return;
+        }
+        playClock += ImGui::GetIO().DeltaTime * fps;
+        while (playClock >= 1.0) {
+            playClock -= 1.0;
+            if (currentFrame + 1 < count) {
+                currentFrame++;
+            }
+            else if (loop) {
+                currentFrame = 0;
+            }
+            else {
+                playing = false;
+                break;
+            }
+        }
+    }
+
+    void Update() override {
+        if (frames.empty()) {
+            return;
+        }
+        UpdatePlayback();
+        prefetcher.Seek(currentFrame);
+        ShowCurrentFrame();
+    }
+
+    bool Busy() const override {
+        return playing || (!frames.empty() && displayedFrame != currentFrame);
+    }
+
+    ImageSource MakeImageSource() override {
+        if (!shownFrame.pixels) {
+            return nullptr;
+        }
+        ImageData frame = shownFrame;
+        return [frame](ImageData& out) {
+            out = frame;
+            return true;
+        };
+    }
+
+    // Show the current frame if the prefetcher has it. Otherwise the last frame stays up, so
+    // scrubbing past the buffered range never blocks the UI.
+    // The image on the output pin is shared downstream and may be referenced by this frame's
+    // draw commands, so it is never written to. The new frame goes into the previous frame's
+    // texture once nothing else holds it, which is the steady state during playback: two
+    // textures take turns and none is allocated per frame.
+    void ShowCurrentFrame() {
+        ImageData frame;
+        if (currentFrame == displayedFrame || !prefetcher.TryGet(currentFrame, frame)) {
+            return;
+        }
+        ImageHandle next;
+        if (ImageIsUnique(spareImage) && UpdateTextureFromImage(spareImage->srv, frame)) {
+            next = spareImage;
+        }
+        else {
+            next = MakeImageHandle(CreateTextureFromImage(frame), frame.width, frame.height);
+            if (!next) {
+                return;
+            }
+        }
+        spareImage = image;
+        image = next;
+        imageWidth = frame.width;
+        imageHeight = frame.height;
+        displayedFrame = currentFrame;
+        shownFrame = frame;
+        outputRevision++;
+        outputPins[0].image = image;
+    }
+
+    void DrawContent() override {
+        ImDrawList* drawList = ImGui::GetForegroundDrawList();
+        LayoutPins(ImGui::GetWindowPos());
+        drawList->AddCircleFilled(outputPins[0].Pos, 5.0f, IM_COL32(255, 255, 255, 255));
+
+        ImGui::Text("Image Sequence");
+
+        ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
+        ImGui::InputTextWithHint("##Pattern", "shot_####.png or a folder", pattern, sizeof(pattern));
+        if (ImGui::Button("Browse...")) {
+            // Any frame will do: its number is found in the file name
+            std::string filePath = InputImageNode::OpenImageFileDialog();
+            if (!filePath.empty()) {
+                snprintf(pattern, sizeof(pattern), "%s", filePath.c_str());
+                OpenSequence();
+            }
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Open")) {
+            OpenSequence();
+        }
+
+        int count = (int)frames.size();
+        if (count == 0) {
+            if (!status.empty()) {
+                ImGui::TextWrapped("%s", status.c_str());
+            }
+        }
+        else {
+            if (ImGui::Button(playing ? "Pause" : "Play")) {
+                playing = !playing;
+                playClock = 0.0;
+            }
+            ImGui::SameLine();
+            if (ImGui::Checkbox("Loop", &loop)) {
+                prefetcher.SetLoop(loop);
+            }
+            ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
+            if (ImGui::SliderInt("##Frame", &currentFrame, 0, count - 1)) {
+                playing = false;    // Scrubbing takes over from playback
+            }
+            ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
+            ImGui::SliderInt("##Fps", &fps, 1, 60, "%d fps");
+
+            prefetcher.Seek(currentFrame);
+            ShowCurrentFrame();
+            ImGui::Text("#%d, buffered %d/%d", frames[currentFrame].number, prefetcher.BufferedAhead(), prefetcher.RingSize());
+        }
+
+        if (image && imageWidth > 0 && imageHeight > 0) {
+            float maxWidth = ImGui::GetContentRegionAvail().x;
+            float aspectRatio = (float)imageHeight / (float)imageWidth;
+            float displayWidth = (maxWidth > imageWidth) ? imageWidth : maxWidth;
+            float displayHeight = displayWidth * aspectRatio;
+
+            ImGui::BeginChild("ImagePreview", ImVec2(displayWidth, displayHeight), true);
+            ImGui::Image((ImTextureID)image->srv, ImVec2(displayWidth, displayHeight));
+            ImGui::EndChild();
+        }
+    }
+
+private:
+    vector<SequenceFrame> frames;
+    SequencePrefetcher prefetcher{ 8, 2 };
+    int currentFrame = 0;
+    int displayedFrame = -1;
+    bool playing = false;
+    bool loop = true;
+    int fps = 24;
+    double playClock = 0.0;     // Fraction of a frame accumulated towards the next one
+    string status;
+
+    ImageHandle image;
+    ImageHandle spareImage;     // Previous frame, written over once it is no longer shared
+    ImageData shownFrame;       // Pixels of 'image', for evaluations downstream
+    int imageWidth = 0;
+    int imageHeight = 0;
+};
+
+
+
+
+
+
+bool EvaluateImage(const ImageData& source, const vector<BaseNode::StripStage>& stages, ImageBuffer& out, const CancelToken& cancel);
+
 class OutputImageNode : public BaseNode {
 public:
     bool DisplayImage = false;
     int imageWidth = 500/4;
     int imageHeight = 1000/4;
-    ID3D11ShaderResourceView* imageSRV = nullptr;
+    ImageHandle image;
+
+    // The preview runs the chain's kernels on the thread pool and never on the UI thread. Every
+    // parameter change starts a new generation and cancels the evaluations still running for
+    // older ones, which stop at their next band. Finished results are published to a double
+    // buffer; each frame draws the newest one that completed, however far behind it is.
+    // Only preview-sized pixels are published, and they are uploaded into the same texture
+    // each time. The jobs hold the buffer themselves, so a deleted node does not wait for them.
+    struct PreviewFrame {
+        ImageData pixels;                   // At most NodePreviewSize on either side. Empty if the evaluation failed.
+        unsigned long long generation = 0;
+    };
+    EvaluationGenerations previewGenerations;
+    std::shared_ptr<DoubleBuffer<PreviewFrame>> previewFrames = std::make_shared<DoubleBuffer<PreviewFrame>>();
+    ImageHandle previewImage;       // The last published frame, or null to show the source's image
+    string previewKey;              // Source and parameter revisions of the latest request
+    string previewSourceKey;        // Cache key of the preview-sized source it reads
+    EvaluationGenerations previewSourceGenerations;     // Bumped whenever previewSourceKey changes
+    CancelToken previewSourceToken;
+    std::deque<std::pair<unsigned long long, double>> previewRequests;     // Generations not shown yet, with their ImGui::GetTime()
+    bool previewVisible = false;    // The preview was drawn and on screen last frame
     OutputImageNode() {
         NodeName = "Output Image";
-        NodeId = NodeName + "num";
+        NodeId = NodeName + to_string(GetNextPinId());
         NumOfInputPins = 1;
         NumOfOutputPins = 0;
         ImVec2 winPos = ImGui::GetWindowPos();
@@ -759,36 +1593,168 @@ public:
 
         ImVec2 localPos = ImVec2(0, InitialLoc);
         string PinName = "In";
-        inputPins.push_back({ GetNextPinId(), PinName + "##0", ImVec2(winPos.x + localPos.x, winPos.y + localPos.y), true, NodeId });
+        inputPins.push_back({ GetNextPinId(), g_PinStrings.Intern(PinName + "##0"), ImVec2(winPos.x + localPos.x, winPos.y + localPos.y), true, PinOwner() });
         
     }
 
-    void DrawContent() override {
+    // Evaluations still running are cancelled and left to finish on their own; they only refer
+    // to the frames buffer they share with the node
+    ~OutputImageNode() {
+        previewGenerations.CancelAll();
+        UsePreviewSource("");
+    }
+
+    // Runs on a worker thread. Chains of per-pixel kernels run on a preview-sized copy of the
+    // source, cached per source revision under 'sourceKey', so a parameter change costs a
+    // preview's worth of pixels rather than the whole image. A box filter and a per-pixel kernel
+    // commute up to rounding and clamping. Other chains run at full size and are downscaled after.
+    // 'sourceCurrent' is cancelled once requests move on to another source revision.
+    static void EvaluatePreviewJob(const ImageSource& produce, const string& sourceKey, const CancelToken& sourceCurrent,
+                                   const vector<StripStage>& stages, const CancelToken& cancel, DoubleBuffer<PreviewFrame>& frames) {
+        PreviewFrame frame;
+        frame.generation = cancel.Generation();
+        bool elementwise = all_of(stages.begin(), stages.end(), [](const StripStage& stage) { return stage.elementwise; });
+        ImageData input;
+        bool haveInput = false;
+        if (elementwise) {
+            haveInput = CacheGet(sourceKey, input);
+            if (!haveInput) {
+                auto downscaleStart = std::chrono::steady_clock::now();
+                ImageData full;
+                haveInput = produce(full) && MakeImagePreview(full, NodePreviewSize, input);
+                if (haveInput && input.pixels != full.pixels) {     // A source that fits is used as is
+                    std::chrono::duration<double> downscaleTime = std::chrono::steady_clock::now() - downscaleStart;
+                    CachePut(sourceKey, input, downscaleTime.count());
+                    // The UI may have erased the key already, and would not again
+                    if (sourceCurrent.IsCancelled()) {
+                        CacheErase(sourceKey);
+                    }
+                }
+            }
+        }
+        else {
+            haveInput = produce(input);
+        }
+        ImageBuffer output;
+        if (haveInput && EvaluateImage(input, stages, output, cancel)) {
+            MakeImagePreview(output, NodePreviewSize, frame.pixels);
+        }
+        // A superseded evaluation is not worth showing, even if it got to finish
+        if (!cancel.IsCancelled()) {
+            frames.Publish(std::move(frame));
+            WakeUI();
+        }
+    }
+
+    // Drop the cached copy of the previous source revision when requests move to another one,
+    // so replaced images do not pile up in the cache. Jobs still reading the old key see their
+    // source token cancelled and erase anything they store after this.
+    void UsePreviewSource(const string& key) {
+        if (key == previewSourceKey) {
+            return;
+        }
+        previewSourceToken = previewSourceGenerations.Next();
+        if (!previewSourceKey.empty()) {
+            CacheErase(previewSourceKey);
+        }
+        previewSourceKey = key;
+    }
+
+    // Start evaluating the chain again if the source image or any parameter changed since the
+    // last request
+    void RequestPreview() {
+        vector<StripStage> stages;
+        BaseNode* source = FindUpstreamSource(inputPins[0].id, &stages);
+        if (!source || stages.empty()) {   // Nothing to evaluate: the source's image is shown as is
+            previewGenerations.CancelAll();
+            previewKey.clear();
+            UsePreviewSource("");
+            previewRequests.clear();
+            previewFrames->ResetFront();
+            previewImage = nullptr;
+            return;
+        }
+        string sourceKey = source->NodeId + "@" + to_string(source->outputRevision);
+        string key = sourceKey;
+        for (const StripStage& stage : stages) {
+            key += "/" + stage.nodeId + "@" + to_string(stage.revision);
+        }
+        if (key == previewKey) {
+            return;
+        }
+        ImageSource produce = source->MakeImageSource();
+        if (!produce) {
+            return;
+        }
+        previewKey = key;
+        UsePreviewSource("preview:" + sourceKey);
+        CancelToken cancel = previewGenerations.Next();
+        previewRequests.push_back({ cancel.Generation(), ImGui::GetTime() });
+
+        // A slider being dragged wants its result now; a preview scrolled out of view can wait
+        TaskPriority priority = ImGui::IsAnyItemActive() ? TaskPriority_Interactive :
+                                previewVisible ? TaskPriority_Visible : TaskPriority_Background;
+        ScopedTaskPriority scope(priority);
+        std::shared_ptr<DoubleBuffer<PreviewFrame>> frames = previewFrames;
+        sourceKey = previewSourceKey;
+        CancelToken sourceCurrent = previewSourceToken;
+        RunDetached([produce, sourceKey, sourceCurrent, stages, cancel, frames]() {
+            EvaluatePreviewJob(produce, sourceKey, sourceCurrent, stages, cancel, *frames);
+        });
+    }
+
+    // Bring the newest finished evaluation to the front, without waiting for anything, and
+    // upload it. Nothing else holds the preview texture, so it is written over in place.
+    void PollPreview() {
+        if (!previewFrames->Swap()) {
+            return;
+        }
+        const PreviewFrame& frame = previewFrames->Front();
+        while (!previewRequests.empty() && previewRequests.front().first <= frame.generation) {
+            previewRequests.pop_front();
+        }
+        if (!frame.pixels.pixels) {
+            previewImage = nullptr;
+        }
+        else if (!previewImage || !UpdateTextureFromImage(previewImage->srv, frame.pixels)) {
+            previewImage = MakeImageHandle(CreateTextureFromImage(frame.pixels), frame.pixels.width, frame.pixels.height);
+        }
+    }
+
+    // How long the parameters have been ahead of the preview, or 0 if it is up to date
+    double PreviewStaleSeconds() const {
+        return previewRequests.empty() ? 0.0 : ImGui::GetTime() - previewRequests.front().second;
+    }
+
+    void Update() override {
+        // Let go of the image when the link goes away, so its texture can be freed
+        image = nullptr;
+        DisplayImage = false;
         for (auto& Link : links) {
             Pin* fromPin = GetPinById(Link.fromPinId);
             Pin* toPin = GetPinById(Link.toPinId);
 
             // Check if the link connects to this node
-            if (fromPin->IsInputNodePin && toPin->ParentNodeId == this->NodeId) {
-                imageSRV = fromPin->imageSRV;
-                if (imageSRV) {
+            if (fromPin->IsInputNodePin && toPin->ParentNode == PinOwner()) {
+                image = fromPin->image;
+                if (image) {
                     DisplayImage = true;
                     break;
                 }
             }
             // If the link doesn't directly connect to this node, check the reverse link
-            else if (fromPin->IsInputNodePin && toPin->ParentNodeId != this->NodeId) {
-                string ID = toPin->ParentNodeId;
+            else if (fromPin->IsInputNodePin && toPin->ParentNode != PinOwner()) {
+                int ID = toPin->ParentNode;
 
                 // Search for a reverse link to this node
                 for (auto& reverseLink : links) {
                     Pin* reverseFromPin = GetPinById(reverseLink.fromPinId);
                     Pin* reverseToPin = GetPinById(reverseLink.toPinId);
-                    if (reverseFromPin->ParentNodeId == ID && reverseToPin->ParentNodeId == this->NodeId) {
-                        imageSRV = fromPin->imageSRV;
-                        if (imageSRV) {
+                    if (reverseFromPin->ParentNode == ID && reverseToPin->ParentNode == PinOwner()) {
+                        image = fromPin->image;
+                        if (image) {
                             reverseFromPin->IsConnectedToMiddle = true;
-                            reverseFromPin->imageSRV = imageSRV;
+                            reverseFromPin->image = image;  // Another reference, no pixels copied
                             DisplayImage = true;
                             cout << 1;
                             break;
@@ -803,14 +1769,20 @@ public:
             }
         }
 
+        PollPreview();
+        RequestPreview();
+        previewVisible = false;     // Until DrawContent shows it
+    }
+
+    bool Busy() const override {
+        return !previewRequests.empty();
+    }
+
+    void DrawContent() override {
         ImDrawList* drawList = ImGui::GetForegroundDrawList();
-        ImVec2 winPos = ImGui::GetWindowPos();
-        ImVec2 winSize = ImGui::GetWindowSize();
-        float InitialLoc = 120.0f;
+        LayoutPins(ImGui::GetWindowPos());
 
         // Draw input pin
-        ImVec2 localPos = ImVec2(0, InitialLoc);
-        inputPins[0].Pos = ImVec2(winPos.x + localPos.x, winPos.y + localPos.y);
         drawList->AddCircleFilled(inputPins[0].Pos, 5.0f, IM_COL32(255, 255, 255, 255));
 
         
@@ -822,30 +1794,453 @@ public:
             float displayWidth = (maxWidth > imageWidth) ? imageWidth : maxWidth;
             float displayHeight = displayWidth * aspectRatio;
 
+            // Blinks by for quick evaluations, so only lags a user could notice are flagged
+            const double StaleNoticeSeconds = 0.05;
+            double stale = PreviewStaleSeconds();
             ImGui::Text("Preview:");
+            if (stale > StaleNoticeSeconds) {
+                ImGui::SameLine();
+                ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.2f, 1.0f), "stale by %.0f ms", stale * 1000.0);
+            }
             ImGui::BeginChild("ImagePreview", ImVec2(displayWidth, displayHeight), true);
-            ImGui::Image((ImTextureID)imageSRV, ImVec2(displayWidth, displayHeight));
+            ImGui::Image((ImTextureID)(previewImage ? previewImage : image)->srv, ImVec2(displayWidth, displayHeight));
+            previewVisible = ImGui::IsItemVisible();
             ImGui::EndChild();
         }
+    }
+};
 
-        // Update pins
-        Pins.erase(remove_if(Pins.begin(), Pins.end(), [this](const Pin& p) { return p.ParentNodeId == this->NodeId; }), Pins.end());
-        Pins.insert(Pins.end(), inputPins.begin(), inputPins.end());
-        DrawLinksAndHandleDrag(Pins);
+
+
+// Pull an image from 'reader' through 'stages' into 'writer' one strip at a time, so peak
+// memory is a few strips of the image's width rather than the whole image. 'cancel' is checked
+// between strips and between the bands of each strip; a cancelled run returns false without
+// finishing the writer.
+bool RunStripPipeline(ImageStripReader* reader, const vector<BaseNode::StripStage>& stages, ImageStripWriter* writer,
+                      std::atomic<float>* progress, const CancelToken& cancel) {
+    const int width = reader->Width();
+    const int height = reader->Height();
+
+    // About 8 MB per strip: big enough for the PNG writer to keep every thread busy
+    const size_t StripBytes = 8 << 20;
+    int stripRows = (int)std::max<size_t>(1, StripBytes / AlignedStride(width, PixelFormat_RGBA8));
+    stripRows = std::min(stripRows, height);
+    const size_t BandBytes = 256 << 10;
+    const int bandRows = (int)std::max<size_t>(1, BandBytes / AlignedStride(width, PixelFormat_RGBA8));
+
+    // Node 0 is the reader, node i + 1 the output of stage i. Elementwise stages run in place, so
+    // a chain of them needs one strip however long it is.
+    vector<PlanNode> planNodes(stages.size() + 1);
+    for (size_t i = 0; i < planNodes.size(); i++) {
+        planNodes[i].outputBytes = (size_t)AlignedStride(width, PixelFormat_RGBA8) * stripRows;
+        if (i > 0) {
+            planNodes[i].inputs.push_back((int)i - 1);
+            planNodes[i].elementwise = stages[i - 1].elementwise;
+        }
     }
+    planNodes.back().keepOutput = true;
+    MemoryPlan plan;
+    PlanMemory(planNodes, plan);
+    vector<ImageBuffer> strips(plan.bufferSizes.size());
+    for (ImageBuffer& strip : strips) {
+        if (!strip.Allocate(width, stripRows)) {
+            return false;
+        }
+    }
+
+    for (int y = 0; y < height; y += stripRows) {
+        int rowCount = std::min(stripRows, height - y);
+        if (cancel.IsCancelled() || !reader->ReadRows(strips[plan.bufferOf[0]].Rows(0, rowCount))) {
+            return false;
+        }
+        for (size_t i = 0; i < stages.size(); i++) {
+            ImageBuffer src = strips[plan.bufferOf[i]].Rows(0, rowCount);
+            ImageBuffer dst = strips[plan.bufferOf[i + 1]].Rows(0, rowCount);
+            if (!stages[i].elementwise) {
+                ScratchScope scope;
+                stages[i].kernel(src, dst);
+                continue;
+            }
+            // Rows don't depend on each other, so the strip is cut into bands that run on the
+            // thread pool. Bands span whole rows: kernels may write into the row padding.
+            ParallelForTiles(width, rowCount, width, bandRows, [&](const TileRect& band) {
+                if (cancel.IsCancelled()) {
+                    return;
+                }
+                ScratchScope scope;
+                ImageBuffer bandDst = dst.Rows(band.y0, band.y1 - band.y0);
+                stages[i].kernel(src.Rows(band.y0, band.y1 - band.y0), bandDst);
+            });
+        }
+        if (cancel.IsCancelled() || !writer->WriteRows(strips[plan.bufferOf.back()].Rows(0, rowCount))) {
+            return false;
+        }
+        if (progress) {
+            progress->store((float)(y + rowCount) / height);
+        }
+    }
+    return writer->Finish();
+}
+
+// Same, into a file
+bool RunStripPipeline(ImageStripReader* reader, const vector<BaseNode::StripStage>& stages, const std::string& outputPath,
+                      ImageFileFormat format, PngCompression level, std::atomic<float>* progress) {
+    std::unique_ptr<ImageStripWriter> writer = OpenImageStripWriter(outputPath, format, reader->Width(), reader->Height(), level);
+    if (!writer) {
+        return false;
+    }
+    return RunStripPipeline(reader, stages, writer.get(), progress, CancelToken());
+}
+
+// Collects the rows of an evaluation in memory
+class ImageBufferStripWriter : public ImageStripWriter {
+public:
+    explicit ImageBufferStripWriter(ImageBuffer& image) : image(image) {}
+
+    bool WriteRows(const unsigned char* rgba, int stride, int rowCount) override {
+        if (rowsWritten + rowCount > image.height) {
+            return false;
+        }
+        for (int y = 0; y < rowCount; y++) {
+            memcpy(image.Row(rowsWritten + y), rgba + (size_t)y * stride, image.RowBytes());
+        }
+        rowsWritten += rowCount;
+        return true;
+    }
+
+    bool Finish() override { return rowsWritten == image.height; }
+
+private:
+    ImageBuffer& image;
+    int rowsWritten = 0;
 };
 
+bool EvaluateImage(const ImageData& source, const vector<BaseNode::StripStage>& stages, ImageBuffer& out, const CancelToken& cancel) {
+    if (!out.Allocate(source.width, source.height)) {
+        return false;
+    }
+    bool elementwise = all_of(stages.begin(), stages.end(), [](const BaseNode::StripStage& stage) { return stage.elementwise; });
+    if (!elementwise || source.format != PixelFormat_RGBA8) {
+        std::unique_ptr<ImageStripReader> reader = MakeMemoryStripReader(source);
+        ImageBufferStripWriter writer(out);
+        return RunStripPipeline(reader.get(), stages, &writer, nullptr, cancel);
+    }
 
+    // The whole image is at hand, so an elementwise chain can run in place on bands of the
+    // output in any order: the middle of the preview, where the eye goes, is computed first
+    const int bandRows = (int)std::max<size_t>(1, (256 << 10) / out.stride);
+    ParallelForTiles(out.width, out.height, out.width, bandRows, [&](const TileRect& band) {
+        if (cancel.IsCancelled()) {
+            return;
+        }
+        ImageBuffer rows = out.Rows(band.y0, band.y1 - band.y0);
+        for (int y = band.y0; y < band.y1; y++) {
+            memcpy(out.Row(y), source.pixels + (size_t)y * source.stride, out.RowBytes());
+        }
+        ScratchScope scope;
+        for (const BaseNode::StripStage& stage : stages) {
+            stage.kernel(rows, rows);
+        }
+    }, TileOrder_CentreOut);
+    return !cancel.IsCancelled();
+}
 
-vector<std::unique_ptr<BaseNode>> nodes;
+// Same, from a file. The pixels decoded when the file was loaded are used if they are still
+// cached; otherwise files that can't be read in strips are decoded whole first.
+bool RunStripPipeline(const std::string& sourcePath, const vector<BaseNode::StripStage>& stages, const std::string& outputPath,
+                      ImageFileFormat format, PngCompression level, std::atomic<float>* progress) {
+    ImageData image;
+    std::unique_ptr<ImageStripReader> reader;
+    if (CacheGet(sourcePath, image)) {
+        reader = MakeMemoryStripReader(image);
+    }
+    else {
+        reader = OpenImageStripReader(sourcePath);
+    }
+    if (!reader) {
+        if (!ReadImageFile(sourcePath, image)) {
+            return false;
+        }
+        reader = MakeMemoryStripReader(image);
+    }
+    return RunStripPipeline(reader.get(), stages, outputPath, format, level, progress);
+}
 
+// Process every frame of a sequence into numbered files. The next frame is decoded by a pool
+// task while the current one goes through the stages and the encoder, so I/O, decoding and
+// processing overlap instead of taking turns. Waiting for it runs queued tasks, so this is safe
+// to call from a pool task however small the pool is.
+bool RunSequencePipeline(const vector<SequenceFrame>& frames, const vector<BaseNode::StripStage>& stages, const std::string& outputPattern,
+                         ImageFileFormat format, PngCompression level, std::atomic<float>* progress) {
+    ImageData next;
+    bool nextDecoded = !frames.empty() && ReadImageFile(frames[0].path, next);
+    for (int i = 0; i < (int)frames.size(); i++) {
+        if (!nextDecoded) {
+            return false;
+        }
+        ImageData image = std::move(next);
+        next = ImageData();
+        nextDecoded = false;
+        TaskGroup ahead;
+        if (i + 1 < (int)frames.size()) {
+            std::string path = frames[i + 1].path;
+            ahead.Run([&next, &nextDecoded, path]() { nextDecoded = ReadImageFile(path, next); });
+        }
+        std::unique_ptr<ImageStripReader> reader = MakeMemoryStripReader(image);
+        bool written = RunStripPipeline(reader.get(), stages, FormatFramePath(outputPattern, frames[i].number), format, level, nullptr);
+        ahead.Wait();
+        if (!written) {
+            return false;
+        }
+        progress->store((float)(i + 1) / frames.size());
+    }
+    return true;
+}
+
+class ImageWriterNode : public BaseNode {
+public:
+    char outputPath[260] = "output.png";
+    int compression = PngCompression_Fast;
+    ImageWriterNode() {
+        NodeName = "Image Writer";
+        NodeId = NodeName + to_string(GetNextPinId());
+        NumOfInputPins = 1;
+        NumOfOutputPins = 0;
+        ImVec2 winPos = ImGui::GetWindowPos();
+        float InitialLoc = 120.0f;
 
+        ImVec2 localPos = ImVec2(0, InitialLoc);
+        string PinName = "In";
+        inputPins.push_back({ GetNextPinId(), g_PinStrings.Intern(PinName + "##0"), ImVec2(winPos.x + localPos.x, winPos.y + localPos.y), true, PinOwner() });
+    }
 
+    // A save still running finishes on its own: it only holds its progress, not the node
+    ~ImageWriterNode() {
+        saveJob.Detach();
+    }
+
+    std::string SaveImageFileDialog() {
+        OPENFILENAME ofn;
+        wchar_t szFile[260] = L"output.png";
+        ZeroMemory(&ofn, sizeof(ofn));
+        ofn.lStructSize = sizeof(ofn);
+        ofn.hwndOwner = nullptr;
+        ofn.lpstrFile = szFile;
+        ofn.nMaxFile = sizeof(szFile) / sizeof(wchar_t);
+        ofn.lpstrFilter = L"PNG Image\0*.PNG\0QOI Image\0*.QOI\0PPM Image\0*.PPM\0PAM Image\0*.PAM\0PFM Image\0*.PFM\0Raw Dump\0*.RAW\0";
+        ofn.nFilterIndex = 1;
+        ofn.lpstrTitle = L"Save Image File";
+        ofn.lpstrDefExt = L"png";
+        ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT;
+
+        if (GetSaveFileName(&ofn) == TRUE) {
+            std::wstring wstr(ofn.lpstrFile);
+            return std::string(wstr.begin(), wstr.end());
+        }
+
+        return "";
+    }
 
+    // Saves run on the pool in the batch class, behind previews and loads. Static so they can
+    // outlive the node.
+    static Task<bool> SaveImageTask(std::string sourcePath, vector<StripStage> stages, std::string path, ImageFileFormat format,
+                                    PngCompression level, std::shared_ptr<std::atomic<float>> progress) {
+        co_return RunStripPipeline(sourcePath, stages, path, format, level, progress.get());
+    }
+
+    static Task<bool> SaveSequenceTask(vector<SequenceFrame> frames, vector<StripStage> stages, std::string pattern, ImageFileFormat format,
+                                       PngCompression level, std::shared_ptr<std::atomic<float>> progress) {
+        co_return RunSequencePipeline(frames, stages, pattern, format, level, progress.get());
+    }
+
+    void StartSave(Task<bool> job) {
+        saveStartTime = ImGui::GetTime();
+        status = "Saving...";
+        saveJob = std::move(job);
+        ScopedTaskPriority priority(TaskPriority_Batch);
+        saveJob.Start();
+    }
+
+    // Evaluate the chain feeding this node at full resolution on the pool. The kernels are
+    // built here, on the UI thread, so they see a consistent set of parameters.
+    void SaveImage(InputImageNode* source) {
+        vector<StripStage> stages;
+        FindUpstreamSource(inputPins[0].id, &stages);
+
+        std::string sourcePath = source->GetFilePath();
+        savedRevision = source->outputRevision;
+        std::string path = outputPath;
+        ImageFileFormat format = ImageFormatFromPath(path);
+        PngCompression level = (PngCompression)compression;
+        *saveProgress = 0.0f;
+        StartSave(SaveImageTask(sourcePath, stages, path, format, level, saveProgress));
+    }
+
+    // Every frame of the sequence, numbered through the output path's "####" or "%04d"
+    void SaveSequence(ImageSequenceNode* sequence) {
+        vector<StripStage> stages;
+        FindUpstreamSource(inputPins[0].id, &stages);
+
+        vector<SequenceFrame> frames = sequence->GetFrames();
+        std::string pattern = outputPath;
+        ImageFileFormat format = ImageFormatFromPath(pattern);
+        PngCompression level = (PngCompression)compression;
+        *saveProgress = 0.0f;
+        StartSave(SaveSequenceTask(frames, stages, pattern, format, level, saveProgress));
+    }
+
+    void Update() override {
+        if (saveJob.IsReady()) {
+            char message[64];
+            snprintf(message, sizeof(message), saveJob.Get() ? "Saved in %.0f ms" : "Failed to save image.", (ImGui::GetTime() - saveStartTime) * 1000.0);
+            status = message;
+        }
+
+        // Re-run the chain when the input image was reloaded since the last save. Never writes
+        // over the file being watched, which would reload it again.
+        InputImageNode* source = dynamic_cast<InputImageNode*>(FindUpstreamSource(inputPins[0].id, nullptr));
+        if (saveOnChange && source && !source->GetFilePath().empty() && !saveJob.Valid() &&
+            ImageFormatFromPath(outputPath) != ImageFileFormat_Other &&
+            source->outputRevision != savedRevision && source->GetFilePath() != outputPath) {
+            SaveImage(source);
+        }
+    }
+
+    bool Busy() const override {
+        return saveJob.Valid();
+    }
+
+    void DrawContent() override {
+        ImDrawList* drawList = ImGui::GetForegroundDrawList();
+        LayoutPins(ImGui::GetWindowPos());
+
+        // Draw input pin
+        drawList->AddCircleFilled(inputPins[0].Pos, 5.0f, IM_COL32(255, 255, 255, 255));
+
+        ImGui::Text("Save Output");
+
+        BaseNode* upstream = FindUpstreamSource(inputPins[0].id, nullptr);
+        InputImageNode* source = dynamic_cast<InputImageNode*>(upstream);
+        if (source && source->GetFilePath().empty()) {
+            source = nullptr;
+        }
+        ImageSequenceNode* sequence = dynamic_cast<ImageSequenceNode*>(upstream);
+        if (sequence && sequence->GetFrames().empty()) {
+            sequence = nullptr;
+        }
+
+        ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
+        ImGui::InputText("##OutputPath", outputPath, sizeof(outputPath));
+        if (ImGui::Button("Browse...")) {
+            std::string filePath = SaveImageFileDialog();
+            if (!filePath.empty()) {
+                snprintf(outputPath, sizeof(outputPath), "%s", filePath.c_str());
+            }
+        }
+
+        // The format follows the file extension; only PNG has a compression choice
+        ImageFileFormat format = ImageFormatFromPath(outputPath);
+        if (format == ImageFileFormat_PNG) {
+            const char* compressionNames[] = { "Store", "Fast" };
+            ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
+            ImGui::Combo("##Compression", &compression, compressionNames, IM_ARRAYSIZE(compressionNames));
+        }
+        else {
+            ImGui::Text("Format: %s", format == ImageFileFormat_Other ? "unsupported" : ImageFormatName(format));
+        }
+
+        ImGui::BeginDisabled((source == nullptr && sequence == nullptr) || saveJob.Valid() || format == ImageFileFormat_Other);
+        if (ImGui::Button(sequence ? "Save Sequence" : "Save")) {
+            if (sequence) {
+                SaveSequence(sequence);
+            }
+            else {
+                SaveImage(source);
+            }
+        }
+        ImGui::EndDisabled();
+        if (ImGui::Checkbox("Save when input changes", &saveOnChange) && source) {
+            savedRevision = source->outputRevision;     // Only later changes
+        }
+
+        if (saveJob.Valid()) {
+            ImGui::ProgressBar(*saveProgress, ImVec2(ImGui::GetContentRegionAvail().x, 0));
+        }
+        else if (sequence) {
+            ImGui::TextWrapped("Frames go to %s", FormatFramePath(outputPath, sequence->GetFrames()[0].number).c_str());
+        }
+        else if (source == nullptr) {
+            ImGui::TextWrapped("Connect an image to save.");
+        }
+        else if (!status.empty()) {
+            ImGui::TextWrapped("%s", status.c_str());
+        }
+    }
+
+private:
+    Task<bool> saveJob;
+    std::shared_ptr<std::atomic<float>> saveProgress = std::make_shared<std::atomic<float>>(0.0f);
+    double saveStartTime = 0.0;
+    string status;
+    bool saveOnChange = false;
+    int savedRevision = 0;      // Source revision written by the last save
+};
+
+
+
+
+
+
+// Compare PNG, QOI and raw formats on a corpus: example_win32_directx11 --bench-formats a.png b.jpg ...
+int RunFormatBenchmark(int fileCount, char** files)
+{
+    for (int i = 0; i < fileCount; i++) {
+        ImageData image;
+        if (!ReadImageFile(files[i], image)) {
+            std::cerr << "Failed to load " << files[i] << std::endl;
+            continue;
+        }
+        BenchmarkImageFormats(files[i], image.pixels, image.width, image.height, image.stride);
+    }
+    return 0;
+}
+
+// Frame pacing. With nothing going on, the main loop sleeps until input arrives or background
+// work wakes it (UIWake.h). While a node is busy it draws at most g_FrameRateCap frames per
+// second. With idle sleep off it draws every vsync, whether anything changed or not.
+static bool g_SleepWhenIdle = true;
+static int g_FrameRateCap = 60;
+
+// ImGui settles hover and layout a frame or two after the event that changed them
+static const int FramesAfterInput = 3;
 
 // Main code
-int main(int, char**)
+int main(int argc, char** argv)
 {
+    if (argc > 2 && strcmp(argv[1], "--bench-formats") == 0)
+        return RunFormatBenchmark(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "--check-scheduler") == 0)
+        return CheckTaskPriorities() ? 0 : 1;
+    if (argc > 1 && strcmp(argv[1], "--check-params") == 0)
+        return CheckParamChannel() ? 0 : 1;
+    if (argc > 1 && strcmp(argv[1], "--check-streaming") == 0)
+        return CheckStreamingMemory("check_streaming.png", argc > 2 ? atoi(argv[2]) : 50000) ? 0 : 1;
+
+    // Share of the machine for this session, when several run side by side:
+    // --memory-budget <MB> --threads <count> --fps-cap <fps> --no-idle-sleep
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-idle-sleep") == 0)
+            g_SleepWhenIdle = false;
+        else if (i + 1 == argc)
+            break;
+        else if (strcmp(argv[i], "--memory-budget") == 0)
+            SetMemoryBudget((size_t)std::max(atoi(argv[i + 1]), 256) << 20);
+        else if (strcmp(argv[i], "--threads") == 0)
+            SetThreadPoolSize(atoi(argv[i + 1]));
+        else if (strcmp(argv[i], "--fps-cap") == 0)
+            g_FrameRateCap = std::max(atoi(argv[i + 1]), 1);
+    }
+
     LoadShader();
 
 
@@ -920,10 +2315,26 @@ int main(int, char**)
 
     // Main loop
     bool done = false;
+    int framesToDraw = FramesAfterInput;
+    bool animating = false;     // Some node was busy last frame
+    auto lastFrameTime = std::chrono::steady_clock::now();
     while (!done)
     {
-
-        
+        // Block until there is something to draw: input, a wake from background work, or the
+        // next frame of an animation at the frame rate cap
+        if (g_SleepWhenIdle && framesToDraw == 0) {
+            DWORD timeout = INFINITE;
+            if (animating) {
+                auto nextFrameTime = lastFrameTime + std::chrono::microseconds(1000000 / g_FrameRateCap);
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(nextFrameTime - std::chrono::steady_clock::now());
+                timeout = (DWORD)std::max((long long)wait.count(), 0LL);
+            }
+            HANDLE wakeEvent = (HANDLE)UIWakeEvent();
+            DWORD result = ::MsgWaitForMultipleObjects(1, &wakeEvent, FALSE, timeout, QS_ALLINPUT);
+            if (result == WAIT_OBJECT_0 || result == WAIT_TIMEOUT) {
+                framesToDraw = 1;
+            }
+        }
 
         // Poll and handle messages (inputs, window resize, etc.)
         // See the WndProc() function below for our to dispatch events to the Win32 backend.
@@ -934,9 +2345,12 @@ int main(int, char**)
             ::DispatchMessage(&msg);
             if (msg.message == WM_QUIT)
                 done = true;
+            framesToDraw = FramesAfterInput;
         }
         if (done)
             break;
+        if (g_SleepWhenIdle && framesToDraw == 0)
+            continue;   // Woken by a message that was handled without reaching the queue
 
         // Handle window being minimized or screen locked
         if (g_SwapChainOccluded && g_pSwapChain->Present(0, DXGI_PRESENT_TEST) == DXGI_STATUS_OCCLUDED)
@@ -955,11 +2369,23 @@ int main(int, char**)
             CreateRenderTarget();
         }
 
+        framesToDraw = std::max(framesToDraw - 1, 0);
+        lastFrameTime = std::chrono::steady_clock::now();
+
         // Start the Dear ImGui frame
         ImGui_ImplDX11_NewFrame();
         ImGui_ImplWin32_NewFrame();
         ImGui::NewFrame();
 
+        RequestMemoryBudget();
+
+        // Hot reload: each changed file goes only to the nodes that loaded it
+        for (const string& path : g_FileWatcher.PollChanges()) {
+            for (auto& node : nodes) {
+                node->OnFileChanged(path);
+            }
+        }
+
         
         
 
@@ -987,7 +2413,7 @@ int main(int, char**)
         if (ImGui::IsWindowHovered(ImGuiHoveredFlags_AllowWhenBlockedByPopup)) {
             if (wheel != 0.0f) {
                 gridZoom += wheel * ZoomStepSize;
-                gridZoom = CLAMP(gridZoom, 0.5f, 2.0f);
+                gridZoom = CLAMP(gridZoom, CanvasZoomMin, CanvasZoomMax);
             }
         }
 
@@ -995,25 +2421,33 @@ int main(int, char**)
         ImDrawList* drawList = ImGui::GetWindowDrawList();
         ImVec2 canvasPos = ImGui::GetCursorScreenPos();  // screen-space top-left
         ImVec2 canvasSize = ImGui::GetContentRegionAvail();
-        ImVec2 origin = canvasPos;
-
-        float gridSpacing = 20.0f*gridZoom;
-        ImU32 gridColor = IM_COL32(200, 200, 200, 40);
-
-        for (float x = fmodf(origin.x, gridSpacing); x < canvasPos.x + canvasSize.x; x += gridSpacing)
-            drawList->AddLine(ImVec2(x, canvasPos.y), ImVec2(x, canvasPos.y + canvasSize.y), gridColor);
-
-        for (float y = fmodf(origin.y, gridSpacing); y < canvasPos.y + canvasSize.y; y += gridSpacing)
-            drawList->AddLine(ImVec2(canvasPos.x, y), ImVec2(canvasPos.x + canvasSize.x, y), gridColor);
+        DrawCanvasGrid(drawList, canvasPos, canvasSize, gridZoom);
 
         ImVec2 gridMin = ImGui::GetWindowPos();                     // Top-left of grid
         ImVec2 gridSize = ImGui::GetWindowSize();                   // Size of grid
         ImVec2 gridMax(gridMin.x + gridSize.x, gridMin.y + gridSize.y);
 
+        UpdateCanvasHover();
+        HandleLinkMouse();
+
+        // Nodes too small on screen for their widgets are drawn as proxies instead of full
+        // windows. Nodes not drawn yet have no rectangle, and are drawn in full to get one.
+        const float NodeDetailMinSize = 64.0f;
+        animating = io.WantTextInput;   // The text cursor blinks
         for (int i = 0; i < nodes.size(); ++i) {
+            nodes[i]->Update();
+            animating = animating || nodes[i]->Busy();
+            ImVec2 screenSize = nodes[i]->ScreenSize();
+            bool tiny = std::min(screenSize.x, screenSize.y) < NodeDetailMinSize;
+            if (tiny && g_NodeGrid.Contains(nodes[i]->PinOwner())) {
+                nodes[i]->DrawProxy(drawList);
+                continue;
+            }
             std::string uniqueName = nodes[i]->NodeName + "##" + std::to_string(i);
             nodes[i]->Draw(gridMin, gridMax, uniqueName);
         }
+        UpdatePinGeometry();
+        DrawLinkLayer(gridMin, gridMax);
 
         ImGui::EndChild();
 
@@ -1042,6 +2476,41 @@ int main(int, char**)
             node->position = NodeSpawnPos;
             nodes.push_back(std::move(node));
         }
+        else if (ImGui::Button("Create Image Sequence Node")) {
+            auto node = std::make_unique<ImageSequenceNode>();
+            node->position = NodeSpawnPos;
+            nodes.push_back(std::move(node));
+        }
+        else if (ImGui::Button("Create Image Writer Node")) {
+            auto node = std::make_unique<ImageWriterNode>();
+            node->position = NodeSpawnPos;
+            nodes.push_back(std::move(node));
+        }
+
+        BufferPoolStats poolStats = GetBufferPoolStats();
+        ImGui::Separator();
+        ImGui::Text("Buffer pool: %.1f MB in use, %.1f / %.0f MB cached", poolStats.bytesInUse / 1048576.0,
+                    poolStats.bytesCached / 1048576.0, poolStats.limit / 1048576.0);
+        ImGui::Text("Hit rate: %.1f%% of %llu allocations", poolStats.HitRate() * 100.0f, poolStats.allocations);
+        if (ImGui::Button("Trim Buffer Pool")) {
+            TrimBufferPool();
+        }
+
+        MemoryGovernorStats memoryStats = GetMemoryGovernorStats();
+        ImGui::Text("Memory: %.0f / %.0f MB", memoryStats.usage / 1048576.0, memoryStats.budget / 1048576.0);
+        ImGui::Text("Cache: %d images, %.1f MB resident, %.1f MB spilled", memoryStats.entries,
+                    memoryStats.residentBytes / 1048576.0, memoryStats.spilledBytes / 1048576.0);
+        ImGui::Text("Evicted %llu, spilled %llu", memoryStats.evictions, memoryStats.spills);
+        int budgetMB = (int)(memoryStats.budget >> 20);
+        if (ImGui::InputInt("Budget (MB)", &budgetMB, 256, 1024, ImGuiInputTextFlags_EnterReturnsTrue)) {
+            SetMemoryBudget((size_t)std::max(budgetMB, 256) << 20);
+        }
+
+        ImGui::Separator();
+        ImGui::Checkbox("Sleep when idle", &g_SleepWhenIdle);
+        ImGui::BeginDisabled(!g_SleepWhenIdle);
+        ImGui::SliderInt("Frame rate cap", &g_FrameRateCap, 1, 240, "%d fps", ImGuiSliderFlags_AlwaysClamp);
+        ImGui::EndDisabled();
 
         ImGui::EndChild();
 